@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+
+# hello.py as a long-lived FastCGI application, for --fastcgi. It accepts
+# connections on the socket it inherits as fd 0 and answers any number of
+# requests on each, so the interpreter starts once rather than per request.
+
+import socket, struct
+from html import escape
+from urllib.parse import parse_qs
+
+BEGIN_REQUEST, END_REQUEST, PARAMS, STDIN, STDOUT = 1, 3, 4, 5, 6
+KEEP_CONN = 1
+
+
+def read_exact(conn, n):
+    data = b''
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def read_record(conn):
+    header = read_exact(conn, 8)
+    if header is None:
+        return None
+    _, kind, request_id, length, padding = struct.unpack('>BBHHBx', header)
+    content = read_exact(conn, length + padding)
+    if content is None:
+        return None
+    return kind, request_id, content[:length]
+
+
+def write_record(conn, kind, request_id, content):
+    for start in range(0, max(len(content), 1), 65535):
+        part = content[start:start + 65535]
+        conn.sendall(struct.pack('>BBHHBx', 1, kind, request_id, len(part), 0) + part)
+
+
+def parse_params(data):
+    params, i = {}, 0
+    while i < len(data):
+        lengths = []
+        for _ in range(2):
+            if data[i] < 128:
+                lengths.append(data[i])
+                i += 1
+            else:
+                lengths.append(struct.unpack('>I', data[i:i + 4])[0] & 0x7fffffff)
+                i += 4
+        name = data[i:i + lengths[0]].decode('latin-1')
+        i += lengths[0]
+        params[name] = data[i:i + lengths[1]].decode('latin-1')
+        i += lengths[1]
+    return params
+
+
+def respond(params, body):
+    query = parse_qs(params.get('QUERY_STRING', ''))
+    name = query.get('name', ['Unknown'])[0]
+    page = ('<html><body>\n'
+            '<h1>Hello!</h1>\n'
+            f'<h2>Nice to meet you, {escape(name)}!</h2>\n'
+            '</body></html>\n')
+    return ('Status: 200 OK\r\n'
+            'Content-Type: text/html\r\n'
+            f'Server: {params.get("SERVER_SOFTWARE", "")}\r\n'
+            '\r\n' + page).encode()
+
+
+def serve(conn):
+    while True:
+        params, body, keep = b'', b'', False
+        while True:
+            record = read_record(conn)
+            if record is None:
+                return
+            kind, request_id, content = record
+            if kind == BEGIN_REQUEST:
+                keep = content[2] & KEEP_CONN
+            elif kind == PARAMS:
+                params += content
+            elif kind == STDIN:
+                if not content:
+                    break
+                body += content
+
+        write_record(conn, STDOUT, request_id, respond(parse_params(params), body))
+        write_record(conn, STDOUT, request_id, b'')
+        write_record(conn, END_REQUEST, request_id, struct.pack('>IB3x', 0, 0))
+        if not keep:
+            return
+
+
+listener = socket.socket(fileno=0)
+while True:
+    conn, _ = listener.accept()
+    with conn:
+        serve(conn)
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "cache_list.h"
+
+// FNV-1a; paths are short and this keeps the hash dependency-free.
+uint64_t hash_path(const char *path) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)path; *p; ++p) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Whether the last component of path is name, or always if name is NULL.
+ * Matching on the last component alone also catches the aliases a URI can
+ * produce ("/a/./b", "//b").
+ */
+int path_has_name(const char *path, const char *name) {
+    if (!name) {
+        return 1;
+    }
+    size_t path_length = strlen(path);
+    size_t name_length = strlen(name);
+    return path_length > name_length &&
+           path[path_length - name_length - 1] == '/' &&
+           strcmp(path + path_length - name_length, name) == 0;
+}
+
+/**
+ * Whether path, with every symlink resolved, lies under root, itself a
+ * resolved path, and gets there without a symlink below the root. Only
+ * such files are covered by the root's inotify watches: a link can point
+ * out of the tree, and swapping one (a "current" release link, say) is a
+ * single event on the link that says nothing about the paths through it.
+ */
+int path_in_tree(const char *path, const char *root) {
+    char resolved[PATH_MAX];
+    if (!root || !realpath(path, resolved)) {
+        return 0;
+    }
+    size_t root_length = strlen(root);
+    if (strncmp(resolved, root, root_length) != 0 ||
+        (resolved[root_length] != '/' && resolved[root_length] != '\0' && root[root_length - 1] != '/')) {
+        return 0;
+    }
+
+    // Without links, the path ends in the same components it resolves to.
+    const char *suffix = resolved + root_length + (resolved[root_length] == '/');
+    size_t path_length = strlen(path);
+    size_t suffix_length = strlen(suffix);
+    if (suffix_length == 0) {
+        return 1;
+    }
+    if (path_length <= suffix_length || path[path_length - suffix_length - 1] != '/' ||
+        strcmp(path + path_length - suffix_length, suffix) != 0) {
+        return 0;
+    }
+
+    char prefix[PATH_MAX];
+    struct stat st;
+    if (path_length >= sizeof(prefix)) {
+        return 0;
+    }
+    memcpy(prefix, path, path_length + 1);
+    for (size_t i = path_length - suffix_length; i <= path_length; ++i) {
+        if (prefix[i] != '/' && prefix[i] != '\0') {
+            continue;
+        }
+        char saved = prefix[i];
+        prefix[i] = '\0';
+        int link = lstat(prefix, &st) < 0 || S_ISLNK(st.st_mode);
+        prefix[i] = saved;
+        if (link) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void lru_unlink(LruList *list, LruLink *link) {
+    if (link->prev) {
+        link->prev->next = link->next;
+    } else {
+        list->head = link->next;
+    }
+    if (link->next) {
+        link->next->prev = link->prev;
+    } else {
+        list->tail = link->prev;
+    }
+    link->prev = link->next = NULL;
+}
+
+void lru_push_front(LruList *list, LruLink *link) {
+    link->prev = NULL;
+    link->next = list->head;
+    if (list->head) {
+        list->head->prev = link;
+    } else {
+        list->tail = link;
+    }
+    list->head = link;
+}
@@ -0,0 +1,30 @@
+#ifndef CACHE_LIST_H
+#define CACHE_LIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What the memory cache and the fd cache share: the hash their tables are
+// keyed by, and an intrusive LRU list threaded through their entries.
+
+typedef struct LruLink {
+    struct LruLink *prev;             // towards the most recently used
+    struct LruLink *next;
+} LruLink;
+
+typedef struct {
+    LruLink *head;                    // most recently used
+    LruLink *tail;
+} LruList;
+
+// The entry of type whose LruLink member is link, or NULL for no link.
+#define LRU_ENTRY(link, type, member) \
+    ((link) ? (type *)((char *)(link) - offsetof(type, member)) : NULL)
+
+uint64_t hash_path(const char *path);
+int path_has_name(const char *path, const char *name);
+int path_in_tree(const char *path, const char *root);
+void lru_unlink(LruList *list, LruLink *link);
+void lru_push_front(LruList *list, LruLink *link);
+
+#endif
@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "cgi_loop.h"
+#include "event_loop.h"
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define WATCH_INPUT 0                 // the script's stdin can take more of the body
+#define WATCH_OUTPUT 1                // the script wrote something
+#define WATCH_EXIT 2                  // the script exited
+#define WATCH_CLIENT 3                // the client can take more of the response
+
+int prepare_cgi_head(char *head, size_t *head_length, size_t *body_offset, int may_gzip, WorkQueue *queue, z_stream *stream);
+
+void init_cgi_loop(CgiLoop *loop, int timeout) {
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    loop->timeout = timeout;
+    loop->jobs = NULL;
+    pthread_mutex_init(&loop->mutex, NULL);
+
+    pthread_create(&loop->thread, NULL, cgi_loop_thread, loop);
+}
+
+// Spreads jobs over the loops.
+static _Atomic unsigned int next_loop;
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Wraps a script the worker has started for one of the num_loops loops:
+ * in_fd and out_fd are the server's ends of its stdin and stdout, pid the
+ * process or 0 if the zygote forked it, and pidfd then the one the zygote
+ * handed over, if any. Returns NULL if there is no memory, in which case
+ * the caller still owns everything.
+ */
+CgiJob* cgi_job_new(CgiLoop *loops, int num_loops, Connection *conn, int in_fd, int out_fd, pid_t pid,
+                    int pidfd, const char *body, size_t body_length, int may_gzip, WorkQueue *queue) {
+    CgiJob *job = malloc(sizeof(CgiJob));
+    if (!job) {
+        return NULL;
+    }
+    job->body = NULL;
+    if (body_length > 0 && !(job->body = malloc(body_length))) {
+        free(job);
+        return NULL;
+    }
+    if (body_length > 0) {
+        memcpy(job->body, body, body_length);
+    }
+
+    job->loop = &loops[atomic_fetch_add(&next_loop, 1) % num_loops];
+    job->conn = conn;
+    job->queue = queue;
+    job->in_fd = in_fd;
+    job->out_fd = out_fd;
+    job->pid = pid;
+    // Without pidfds (before Linux 5.3) the script is polled for once
+    // its output ends.
+    job->pidfd = pid > 0 ? syscall(SYS_pidfd_open, pid, 0) : pidfd;
+    job->body_length = body_length;
+    job->body_written = 0;
+    job->may_gzip = may_gzip;
+    job->head_done = 0;
+    job->gzip = 0;
+    job->copy = 0;
+    job->output_done = 0;
+    job->done = 0;
+    job->head_length = 0;
+    job->head[0] = '\0';
+    job->out = NULL;
+    job->out_length = 0;
+    job->out_sent = 0;
+    job->out_capacity = 0;
+    job->deadline = now_ms() + job->loop->timeout;
+    job->prev = job->next = NULL;
+
+    set_nonblocking(in_fd);
+    set_nonblocking(out_fd);
+    set_nonblocking(conn->fd);
+    return job;
+}
+
+static void watch(CgiJob *job, int fd, uint32_t events, int kind) {
+    if (fd < 0) {
+        return;
+    }
+    job->watches[kind].job = job;
+    job->watches[kind].kind = kind;
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = &job->watches[kind];
+    if (epoll_ctl(job->loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+    }
+}
+
+/**
+ * Hands a job to its loop. Every descriptor is edge-triggered, so each
+ * is registered once and the job simply works until it would block. The
+ * loop handles events under the same lock, so it cannot touch the job
+ * before it is fully registered.
+ */
+void cgi_loop_add(CgiJob *job) {
+    CgiLoop *loop = job->loop;
+
+    pthread_mutex_lock(&loop->mutex);
+    job->next = loop->jobs;
+    if (loop->jobs) {
+        loop->jobs->prev = job;
+    }
+    loop->jobs = job;
+    watch(job, job->in_fd, EPOLLOUT, WATCH_INPUT);
+    watch(job, job->out_fd, EPOLLIN, WATCH_OUTPUT);
+    watch(job, job->pidfd, EPOLLIN, WATCH_EXIT);
+    watch(job, job->conn->fd, EPOLLOUT, WATCH_CLIENT);
+    pthread_mutex_unlock(&loop->mutex);
+}
+
+// Anything moving, from the client or the script, puts off the deadline.
+static void progress(CgiJob *job) {
+    job->deadline = now_ms() + job->loop->timeout;
+}
+
+static void feed_body(CgiJob *job) {
+    while (job->in_fd >= 0 && job->body_written < job->body_length) {
+        ssize_t n = write(job->in_fd, job->body + job->body_written, job->body_length - job->body_written);
+        if (n > 0) {
+            job->body_written += n;
+            progress(job);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return;
+        } else {
+            break;   // the script is not reading it
+        }
+    }
+    if (job->in_fd >= 0) {
+        close(job->in_fd);
+        job->in_fd = -1;
+    }
+}
+
+static int reserve(CgiJob *job, size_t extra) {
+    if (job->out_length + extra <= job->out_capacity) {
+        return 0;
+    }
+    size_t capacity = job->out_capacity ? job->out_capacity : 16384;
+    while (capacity < job->out_length + extra) {
+        capacity *= 2;
+    }
+    char *out = realloc(job->out, capacity);
+    if (!out) {
+        return -1;
+    }
+    job->out = out;
+    job->out_capacity = capacity;
+    return 0;
+}
+
+static int queue_output(CgiJob *job, const char *data, size_t length) {
+    if (reserve(job, length) < 0) {
+        return -1;
+    }
+    memcpy(job->out + job->out_length, data, length);
+    job->out_length += length;
+    return 0;
+}
+
+static int queue_gzip(CgiJob *job, const char *data, size_t length, int flush) {
+    job->stream.next_in = (Bytef *)data;
+    job->stream.avail_in = length;
+    do {
+        if (reserve(job, 16384) < 0) {
+            return -1;
+        }
+        job->stream.next_out = (Bytef *)job->out + job->out_length;
+        job->stream.avail_out = job->out_capacity - job->out_length;
+        deflate(&job->stream, flush);
+        job->out_length = job->out_capacity - job->stream.avail_out;
+    } while (job->stream.avail_out == 0);
+    if (flush == Z_FINISH) {
+        deflateEnd(&job->stream);
+        job->gzip = 0;
+    }
+    return 0;
+}
+
+// Returns 1 when the head is queued, 0 if the script has more to write
+// first, -1 on failure.
+static int read_head(CgiJob *job) {
+    while (job->head_length < CGI_HEAD_SIZE) {
+        ssize_t n = read(job->out_fd, job->head + job->head_length, CGI_HEAD_SIZE - job->head_length);
+        if (n > 0) {
+            progress(job);
+            job->head_length += n;
+            job->head[job->head_length] = '\0';
+            if (strstr(job->head, "\r\n\r\n")) {
+                break;
+            }
+        } else if (n == 0) {
+            job->output_done = 1;
+            break;
+        } else if (errno == EAGAIN) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+
+    size_t body_offset;
+    job->head_done = 1;
+    job->gzip = prepare_cgi_head(job->head, &job->head_length, &body_offset, job->may_gzip, job->queue, &job->stream);
+    if (!job->gzip) {
+        return queue_output(job, job->head, job->head_length) < 0 ? -1 : 1;
+    }
+    if (queue_output(job, job->head, body_offset) < 0 ||
+        queue_gzip(job, job->head + body_offset, job->head_length - body_offset,
+                   job->output_done ? Z_FINISH : Z_SYNC_FLUSH) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+// Reads one chunk of the body for gzipping or copying. Returns 1 when
+// something was queued or the output ended, 0 if there is nothing to read
+// yet, -1 on failure.
+static int read_body(CgiJob *job) {
+    char chunk[16384];
+    ssize_t n;
+    do {
+        n = read(job->out_fd, chunk, sizeof(chunk));
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return errno == EAGAIN ? 0 : -1;
+    }
+    if (n == 0) {
+        job->output_done = 1;
+    }
+    progress(job);
+    if (job->gzip) {
+        return queue_gzip(job, chunk, n, n == 0 ? Z_FINISH : Z_SYNC_FLUSH) < 0 ? -1 : 1;
+    }
+    return queue_output(job, chunk, n) < 0 ? -1 : 1;
+}
+
+/**
+ * Moves as much of the response as the script and the client allow.
+ * Returns 1 once all of it has been sent, 0 to wait for another event,
+ * -1 if the response cannot be completed.
+ */
+static int move_output(CgiJob *job) {
+    int sock = job->conn->fd;
+
+    while (1) {
+        if (job->out_sent < job->out_length) {
+            ssize_t n = send(sock, job->out + job->out_sent, job->out_length - job->out_sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                job->out_sent += n;
+                progress(job);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN) {
+                return 0;
+            }
+            return -1;
+        }
+        job->out_sent = job->out_length = 0;
+        if (job->output_done) {
+            return 1;
+        }
+
+        int status;
+        if (!job->head_done) {
+            status = read_head(job);
+        } else if (job->gzip || job->copy) {
+            status = read_body(job);
+        } else {
+            ssize_t n = splice(job->out_fd, NULL, sock, NULL, CGI_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                progress(job);
+                continue;
+            }
+            if (n == 0) {
+                job->output_done = 1;
+                return 1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL) {
+                job->copy = 1;
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (status <= 0) {
+            return status;
+        }
+    }
+}
+
+/**
+ * Ends the response: the client is closed, as the script's output has no
+ * length to keep the connection by, and so are the pipes, which tells a
+ * script still writing to stop.
+ */
+static void finish_output(CgiJob *job) {
+    if (job->in_fd >= 0) {
+        close(job->in_fd);
+        job->in_fd = -1;
+    }
+    if (job->out_fd >= 0) {
+        close(job->out_fd);
+        job->out_fd = -1;
+    }
+    if (job->gzip) {
+        deflateEnd(&job->stream);
+        job->gzip = 0;
+    }
+    close_connection(job->conn);
+    job->conn = NULL;
+    free(job->out);
+    job->out = NULL;
+    free(job->body);
+    job->body = NULL;
+
+    job->done = job->pidfd < 0 && job->pid <= 0;
+    // A script that closed its output still gets a while to exit.
+    progress(job);
+}
+
+// Stops a script past its deadline.
+static void kill_script(CgiJob *job) {
+    if (job->pidfd >= 0) {
+        syscall(SYS_pidfd_send_signal, job->pidfd, SIGKILL, NULL, 0);
+    } else if (job->pid > 0) {
+        kill(job->pid, SIGKILL);
+    }
+}
+
+// The pidfd is readable: the script exited. One the zygote forked is the
+// zygote's to wait for, so waitid() has nothing for us then.
+static void reap(CgiJob *job) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int result = waitid(P_PIDFD, job->pidfd, &info, WEXITED | WNOHANG);
+    if ((result == 0 && info.si_pid != 0) || (result < 0 && errno == ECHILD)) {
+        close(job->pidfd);
+        job->pidfd = -1;
+        job->pid = 0;
+        job->done = !job->conn;
+    }
+}
+
+static void run_job(CgiJob *job) {
+    if (!job->conn) {
+        return;   // only waiting for the script to exit
+    }
+    feed_body(job);
+    if (move_output(job) != 0) {
+        finish_output(job);
+    }
+}
+
+/**
+ * Frees finished jobs and ends those that have gone --timeout without
+ * progress: a script that neither reads, writes nor exits, or a client
+ * that stopped reading. The script is killed; its pidfd then reports it,
+ * or without one, the next sweep's waitpid().
+ */
+static void sweep(CgiLoop *loop) {
+    long long now = now_ms();
+
+    CgiJob *job = loop->jobs;
+    while (job) {
+        CgiJob *next = job->next;
+        if (!job->conn && job->pidfd < 0 && job->pid > 0 && waitpid(job->pid, NULL, WNOHANG) != 0) {
+            job->pid = 0;
+            job->done = 1;
+        }
+        if (!job->done && now >= job->deadline) {
+            kill_script(job);
+            if (job->conn) {
+                finish_output(job);
+            }
+        }
+        if (job->done) {
+            if (job->prev) {
+                job->prev->next = job->next;
+            } else {
+                loop->jobs = job->next;
+            }
+            if (job->next) {
+                job->next->prev = job->prev;
+            }
+            free(job);
+        }
+        job = next;
+    }
+}
+
+void* cgi_loop_thread(void *arg) {
+    CgiLoop *loop = (CgiLoop *)arg;
+    struct epoll_event events[CGI_MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(loop->epfd, events, CGI_MAX_EVENTS, 1000);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            continue;
+        }
+        pthread_mutex_lock(&loop->mutex);
+        for (int i = 0; i < n; ++i) {
+            CgiWatch *watch = events[i].data.ptr;
+            CgiJob *job = watch->job;
+            if (job->done) {
+                continue;
+            }
+            if (watch->kind == WATCH_EXIT) {
+                reap(job);
+            } else {
+                run_job(job);
+            }
+        }
+        // Jobs are freed only here, after every event that may name them.
+        sweep(loop);
+        pthread_mutex_unlock(&loop->mutex);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef CGI_LOOP_H
+#define CGI_LOOP_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "thread_pool.h"
+
+#define CGI_HEAD_SIZE 8192            // most a script may send before its body
+#define CGI_HEAD_ROOM (CGI_HEAD_SIZE + 256)  // plus an added status line and Content-Encoding
+#define CGI_PIPE_SIZE (1 << 20)       // script output the kernel buffers; 1 MB is the default cap
+#define CGI_MAX_EVENTS 64
+
+struct Connection;
+struct CgiJob;
+
+// What an event in the CGI loop is about: one descriptor of a job.
+typedef struct {
+    struct CgiJob *job;
+    int kind;
+} CgiWatch;
+
+// A running script and the client waiting on it. Once the worker has
+// started the script, the CGI loop feeds it the request body and relays
+// its output without ever blocking, so a slow script or client ties up
+// nothing but this.
+typedef struct CgiJob {
+    struct CgiLoop *loop;
+    struct Connection *conn;      // closed once the response is out, then NULL
+    WorkQueue *queue;             // consulted for the compression level
+    int in_fd;                    // the script's stdin until the body is in, else -1
+    int out_fd;                   // the script's stdout until the response is out, else -1
+    int pidfd;                    // the script until it is reaped, else -1
+    pid_t pid;                    // 0 when the zygote started the script, which is not ours to wait for
+    char *body;                   // the request body, copied
+    size_t body_length;
+    size_t body_written;
+    int may_gzip;
+    int head_done;                // the head has been read and queued
+    int gzip;                     // the body goes through stream
+    int copy;                     // splice() cannot reach the socket; copy instead
+    int output_done;              // the script's output has all been read
+    int done;                     // nothing left to do; freed after this round of events
+    z_stream stream;
+    char head[CGI_HEAD_ROOM];
+    size_t head_length;
+    char *out;                    // bytes waiting for the client
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+    long long deadline;           // monotonic ms after which the script is killed, put off by any progress
+    CgiWatch watches[4];
+    struct CgiJob *prev;          // job list links, guarded by loop->mutex
+    struct CgiJob *next;
+} CgiJob;
+
+// One epoll instance watching the pipes, process and client socket of
+// the CGI scripts in flight, one loop per core.
+typedef struct CgiLoop {
+    int epfd;
+    pthread_t thread;
+    int timeout;
+    pthread_mutex_t mutex;
+    CgiJob *jobs;
+} CgiLoop;
+
+void init_cgi_loop(CgiLoop *loop, int timeout);
+void* cgi_loop_thread(void *arg);
+CgiJob* cgi_job_new(CgiLoop *loops, int num_loops, struct Connection *conn, int in_fd, int out_fd, pid_t pid,
+                    int pidfd, const char *body, size_t body_length, int may_gzip, WorkQueue *queue);
+void cgi_loop_add(CgiJob *job);
+
+#endif
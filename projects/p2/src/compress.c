@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "compress.h"
+
+typedef struct {
+    char type[64];
+    int level;                        // zlib level 1-9, 0 to never compress
+} CompressRule;
+
+// Text formats only: everything with an unknown extension is served as
+// text/plain, so it is left out until configured with --compress.
+static CompressRule rules[COMPRESS_MAX_TYPES] = {
+    { "text/html", 6 },
+    { "text/css", 6 },
+    { "text/javascript", 6 },
+    { "application/javascript", 6 },
+    { "application/json", 6 },
+    { "image/svg+xml", 6 },
+};
+static int num_rules = 6;
+
+/**
+ * Applies a --compress spec such as "text/plain=6,text/html=0" on top of
+ * the defaults: each entry sets the highest gzip level for one MIME type,
+ * 0 turning compression off for it. Returns -1 if the spec is malformed.
+ */
+int compress_configure(const char *spec) {
+    const char *p = spec;
+
+    while (*p) {
+        const char *equals = strchr(p, '=');
+        if (!equals || equals == p || equals - p >= (int)sizeof(rules[0].type)) {
+            return -1;
+        }
+        char *end;
+        long level = strtol(equals + 1, &end, 10);
+        if (end == equals + 1 || level < 0 || level > 9 || (*end && *end != ',')) {
+            return -1;
+        }
+
+        int i = 0;
+        while (i < num_rules && !(strlen(rules[i].type) == (size_t)(equals - p) &&
+                                  strncasecmp(rules[i].type, p, equals - p) == 0)) {
+            i++;
+        }
+        if (i == num_rules) {
+            if (num_rules == COMPRESS_MAX_TYPES) {
+                return -1;
+            }
+            memcpy(rules[i].type, p, equals - p);
+            rules[i].type[equals - p] = '\0';
+            num_rules++;
+        }
+        rules[i].level = level;
+
+        p = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * The configured gzip level for responses of content_type, parameters
+ * such as charset ignored, or 0 if they are not compressed.
+ */
+int compress_level_for(const char *content_type) {
+    size_t length = strcspn(content_type, "; \t\r\n");
+    for (int i = 0; i < num_rules; ++i) {
+        if (strlen(rules[i].type) == length && strncasecmp(rules[i].type, content_type, length) == 0) {
+            return rules[i].level;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Scales max_level down as the pool gets busy, so compression cannot
+ * become the bottleneck at peak: full strength while the other workers
+ * are mostly idle, half once three quarters of them are busy, the fastest
+ * level when connections are queuing, and 0 (send as is) once the queue
+ * is half full.
+ */
+int compress_level(int max_level, WorkQueue *queue) {
+    size_t queued = work_queue_depth(queue);
+    int others = queue->workers - 1;
+    int busy = work_queue_busy(queue) - 1;
+
+    if (queued * 2 >= queue->limit) {
+        return 0;
+    }
+    if (queued > 0) {
+        return max_level > 0 ? 1 : 0;
+    }
+    if (others > 0 && busy * 4 > others * 3) {
+        return (max_level + 1) / 2;
+    }
+    return max_level;
+}
+
+/**
+ * Compresses a whole buffer into a new gzip member. Returns the malloc'd
+ * result, or NULL if memory ran out.
+ */
+char* gzip_buffer(const char *data, size_t length, int level, size_t *compressed_length) {
+    z_stream stream;
+    if (gzip_stream_init(&stream, level) != Z_OK) {
+        return NULL;
+    }
+
+    size_t bound = deflateBound(&stream, length);
+    char *out = malloc(bound);
+    if (!out) {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = length;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = bound;
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&stream);
+        free(out);
+        return NULL;
+    }
+
+    *compressed_length = stream.total_out;
+    deflateEnd(&stream);
+    return out;
+}
+
+// A deflate stream that writes the gzip wrapper (windowBits + 16).
+int gzip_stream_init(z_stream *stream, int level) {
+    memset(stream, 0, sizeof(*stream));
+    return deflateInit2(stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+}
@@ -0,0 +1,17 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <zlib.h>
+#include "thread_pool.h"
+
+#define COMPRESS_MIN_SIZE 256         // smaller bodies are sent as they are
+#define COMPRESS_MAX_TYPES 32         // entries in the per-type level table
+
+int compress_configure(const char *spec);
+int compress_level_for(const char *content_type);
+int compress_level(int max_level, WorkQueue *queue);
+char* gzip_buffer(const char *data, size_t length, int level, size_t *compressed_length);
+int gzip_stream_init(z_stream *stream, int level);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include "encoding.h"
+
+const Encoding encodings[NUM_ENCODINGS] = {
+    { "br", ".br" },
+    { "zstd", ".zst" },
+    { "gzip", ".gz" },
+};
+
+/**
+ * Returns a bit mask, 1 << index into encodings, of the sidecars that
+ * exist as regular files next to path.
+ */
+int probe_sidecars(const char *path) {
+    char sidecar[8192];
+    struct stat st;
+    int available = 0;
+
+    for (int i = 0; i < NUM_ENCODINGS; ++i) {
+        int length = snprintf(sidecar, sizeof(sidecar), "%s%s", path, encodings[i].suffix);
+        if (length < (int)sizeof(sidecar) && stat(sidecar, &st) == 0 && S_ISREG(st.st_mode)) {
+            available |= 1 << i;
+        }
+    }
+    return available;
+}
+
+// A qvalue in thousandths: "1", "0.5", "0.125".
+static int parse_qvalue(const char **p, const char *end) {
+    int q = 0;
+    if (*p < end && (**p == '0' || **p == '1')) {
+        q = (**p - '0') * 1000;
+        (*p)++;
+    }
+    if (*p < end && **p == '.') {
+        (*p)++;
+        for (int scale = 100; *p < end && isdigit((unsigned char)**p); scale /= 10, (*p)++) {
+            q += (**p - '0') * scale;
+        }
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+/**
+ * Picks the encoding in the available mask that the Accept-Encoding
+ * header rates highest (RFC 9110, 12.5.3), preferring earlier entries of
+ * encodings on a tie. Returns its index, or -1 to send the file as is.
+ */
+int choose_encoding(const Str *accept_encoding, int available) {
+    int quality[NUM_ENCODINGS];
+    int wildcard = 0;
+
+    if (!accept_encoding || !available) {
+        return -1;
+    }
+    for (int i = 0; i < NUM_ENCODINGS; ++i) {
+        quality[i] = -1;
+    }
+
+    const char *p = accept_encoding->data;
+    const char *end = p + accept_encoding->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *token = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t token_length = p - token;
+
+        int q = 1000;
+        while (p < end && *p != ',') {
+            if (*p++ != ';') {
+                continue;
+            }
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (end - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=') {
+                p += 2;
+                q = parse_qvalue(&p, end);
+            }
+        }
+
+        if (token_length == 1 && *token == '*') {
+            wildcard = q;
+            continue;
+        }
+        for (int i = 0; i < NUM_ENCODINGS; ++i) {
+            if (strlen(encodings[i].token) == token_length &&
+                strncasecmp(encodings[i].token, token, token_length) == 0) {
+                quality[i] = q;
+            }
+        }
+    }
+
+    int best = -1;
+    int best_quality = 0;
+    for (int i = 0; i < NUM_ENCODINGS; ++i) {
+        int q = quality[i] >= 0 ? quality[i] : wildcard;
+        if ((available & (1 << i)) && q > best_quality) {
+            best = i;
+            best_quality = q;
+        }
+    }
+    return best;
+}
+
+/**
+ * If name is a sidecar ("app.js.gz"), stores the name of the file it
+ * belongs to in base and returns 1; returns 0 otherwise.
+ */
+int sidecar_base(const char *name, char *base, size_t size) {
+    size_t name_length = strlen(name);
+
+    for (int i = 0; i < NUM_ENCODINGS; ++i) {
+        size_t suffix_length = strlen(encodings[i].suffix);
+        if (name_length > suffix_length && name_length - suffix_length < size &&
+            strcmp(name + name_length - suffix_length, encodings[i].suffix) == 0) {
+            memcpy(base, name, name_length - suffix_length);
+            base[name_length - suffix_length] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stddef.h>
+#include "parse.h"
+
+// A content coding the static path can serve from a precompressed
+// sidecar file next to the original ("app.js" -> "app.js.br").
+typedef struct {
+    const char *token;                // name in Accept-Encoding and Content-Encoding
+    const char *suffix;               // extension of the sidecar file
+} Encoding;
+
+// In order of preference when the client accepts several equally.
+#define NUM_ENCODINGS 3
+#define ENCODING_GZIP 2               // the one coding also produced on the fly
+extern const Encoding encodings[NUM_ENCODINGS];
+
+int probe_sidecars(const char *path);
+int choose_encoding(const Str *accept_encoding, int available);
+int sidecar_base(const char *name, char *base, size_t size);
+
+#endif
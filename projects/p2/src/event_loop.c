@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <stdatomic.h>
+#include "event_loop.h"
+#include "uring.h"
+
+void send_error(int sock, const char *status, int keep_alive);
+
+// Sent as is to connections turned away under overload, so shedding costs
+// one non-blocking send and never touches a worker.
+const char overload_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: " OVERLOAD_RETRY_AFTER "\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 32\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "<h1>503 Service Unavailable</h1>";
+const size_t overload_response_length = sizeof(overload_response) - 1;
+
+_Atomic unsigned long shed_count;
+
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Connection* new_connection(int fd, struct sockaddr_in *addr, int server_port) {
+    Connection *conn = malloc(sizeof(Connection));
+    if (!conn) {
+        return NULL;
+    }
+
+    conn->fd = fd;
+    conn->loop = NULL;
+    conn->prefetched = 0;
+    conn->cgi = NULL;
+    conn->buf_len = 0;
+    http_parser_init(&conn->parser);
+    conn->head_scanned = 0;
+    conn->deadline = 0;
+    conn->requests_served = 0;
+    conn->server_port = server_port;
+    conn->client_ip[0] = '\0';
+    if (addr) {
+        inet_ntop(AF_INET, &addr->sin_addr, conn->client_ip, sizeof(conn->client_ip));
+    }
+    conn->prev = conn->next = NULL;
+
+    return conn;
+}
+
+void close_connection(Connection *conn) {
+    close(conn->fd);
+    free(conn);
+}
+
+/**
+ * The client's address, looked up on first use for connections accepted
+ * without one (io_uring's multishot accept).
+ */
+const char* connection_peer(Connection *conn) {
+    if (!conn->client_ip[0]) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (getpeername(conn->fd, (struct sockaddr *)&addr, &len) == 0) {
+            inet_ntop(AF_INET, &addr.sin_addr, conn->client_ip, sizeof(conn->client_ip));
+        }
+    }
+    return conn->client_ip;
+}
+
+// An idle keep-alive connection is closed silently; one that never
+// finished its request is told why.
+void expire_connection(Connection *conn) {
+    if (conn->requests_served == 0 || conn->buf_len > 0) {
+        printf("Connection timed out (socket fd: %d).\n", conn->fd);
+        send_error(conn->fd, "408 Request Timeout", 0);
+    }
+    close_connection(conn);
+}
+
+/**
+ * Answers a connection we have no capacity for with 503 and closes it.
+ * Whatever the client already sent is read and dropped first; closing with
+ * unread data would reset the connection and lose the response.
+ */
+void shed_connection(Connection *conn) {
+    char discard[BUFFER_SIZE];
+    while (recv(conn->fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+    send(conn->fd, overload_response, sizeof(overload_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(conn->fd, SHUT_WR);
+    atomic_fetch_add_explicit(&shed_count, 1, memory_order_relaxed);
+    close_connection(conn);
+}
+
+unsigned long shed_connections(void) {
+    return atomic_load_explicit(&shed_count, memory_order_relaxed);
+}
+
+void init_event_loop(EventLoop *loop, WorkQueue *queue, int timeout) {
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    loop->uring = NULL;
+    loop->work_queue = queue;
+    loop->timeout = timeout;
+    loop->idle_head = NULL;
+    loop->idle_tail = NULL;
+    pthread_mutex_init(&loop->mutex, NULL);
+
+    pthread_create(&loop->thread, NULL, event_loop_thread, loop);
+}
+
+// Deadlines are nearly always later than everything already queued, so
+// walking back from the tail keeps insertion O(1) in practice.
+static void idle_insert(EventLoop *loop, Connection *conn) {
+    Connection *after = loop->idle_tail;
+    while (after && after->deadline > conn->deadline) {
+        after = after->prev;
+    }
+
+    conn->prev = after;
+    conn->next = after ? after->next : loop->idle_head;
+    if (conn->next) {
+        conn->next->prev = conn;
+    } else {
+        loop->idle_tail = conn;
+    }
+    if (after) {
+        after->next = conn;
+    } else {
+        loop->idle_head = conn;
+    }
+}
+
+static void idle_remove(EventLoop *loop, Connection *conn) {
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        loop->idle_head = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    } else {
+        loop->idle_tail = conn->prev;
+    }
+    conn->prev = conn->next = NULL;
+}
+
+static void watch_connection(EventLoop *loop, Connection *conn, int op) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = conn;
+
+    pthread_mutex_lock(&loop->mutex);
+    conn->loop = loop;
+    idle_insert(loop, conn);
+    if (epoll_ctl(loop->epfd, op, conn->fd, &ev) < 0) {
+        perror("epoll_ctl");
+        idle_remove(loop, conn);
+        pthread_mutex_unlock(&loop->mutex);
+        close_connection(conn);
+        return;
+    }
+    pthread_mutex_unlock(&loop->mutex);
+}
+
+// Called by the acceptor for a freshly accepted socket. Reads never block,
+// but responses are written with blocking sends; bound those by the same
+// timeout so a client that stops reading cannot pin a worker forever.
+void event_loop_add(EventLoop *loop, Connection *conn) {
+    struct timeval send_timeout = { loop->timeout / 1000, (loop->timeout % 1000) * 1000 };
+    setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+    conn->deadline = now_ms() + loop->timeout;
+    if (loop->uring) {
+        conn->loop = loop;
+        uring_loop_watch(loop->uring, conn);
+        return;
+    }
+    watch_connection(loop, conn, EPOLL_CTL_ADD);
+}
+
+// Called by a worker that is done with the socket for now. The worker owns
+// conn->deadline: it is reset between requests but not while a request is
+// trickling in, so a slow client cannot extend it.
+void event_loop_rearm(EventLoop *loop, Connection *conn) {
+    if (loop->uring) {
+        uring_loop_rearm(loop->uring, conn);
+        return;
+    }
+    watch_connection(loop, conn, EPOLL_CTL_MOD);
+}
+
+static void expire_idle(EventLoop *loop) {
+    Connection *expired = NULL;
+    long long now = now_ms();
+
+    pthread_mutex_lock(&loop->mutex);
+    while (loop->idle_head && loop->idle_head->deadline <= now) {
+        Connection *conn = loop->idle_head;
+        idle_remove(loop, conn);
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->next = expired;
+        expired = conn;
+    }
+    pthread_mutex_unlock(&loop->mutex);
+
+    while (expired) {
+        Connection *conn = expired;
+        expired = conn->next;
+        expire_connection(conn);
+    }
+}
+
+void* event_loop_thread(void *arg) {
+    EventLoop *loop = (EventLoop *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int wait_ms = loop->timeout;
+        pthread_mutex_lock(&loop->mutex);
+        if (loop->idle_head) {
+            long long left = loop->idle_head->deadline - now_ms();
+            wait_ms = left > 0 ? (int)left : 0;
+        }
+        pthread_mutex_unlock(&loop->mutex);
+
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, wait_ms);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait");
+            }
+            continue;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            Connection *conn = events[i].data.ptr;
+            pthread_mutex_lock(&loop->mutex);
+            idle_remove(loop, conn);
+            pthread_mutex_unlock(&loop->mutex);
+
+            if (enqueue_work(loop->work_queue, conn) < 0) {
+                // Every worker is busy and the backlog is full.
+                shed_connection(conn);
+            }
+        }
+
+        expire_idle(loop);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdatomic.h>
+#include <linux/time_types.h>
+#include "thread_pool.h"
+#include "http_parser.h"
+
+#define BUFFER_SIZE 8192
+#define MAX_EVENTS 64
+#define ENGINE_EPOLL 0
+#define ENGINE_URING 1
+#define OVERLOAD_RETRY_AFTER "1"   // seconds, sent with every 503 under overload
+
+// A client socket together with everything we need to resume it later.
+typedef struct Connection {
+    int fd;
+    struct EventLoop *loop;
+    char client_ip[INET_ADDRSTRLEN];   // empty until connection_peer() looks it up
+    int server_port;
+    char buf[BUFFER_SIZE];
+    int buf_len;
+    HttpParser parser;            // progress through the request head in buf
+    size_t head_scanned;          // how much of buf is known not to end the head
+    long long deadline;           // monotonic ms after which the connection is dropped
+    int requests_served;
+    int prefetched;               // the io_uring engine already read into buf
+    struct CgiJob *cgi;           // a script started for this connection, for the CGI loop
+    struct __kernel_timespec expires;  // deadline as handed to io_uring
+    struct Connection *prev;      // idle list links, guarded by loop->mutex
+    struct Connection *next;
+} Connection;
+
+// One epoll instance watching idle connections. Ready sockets are handed
+// to the worker pool; workers give them back with event_loop_rearm().
+// When the io_uring engine serves a listener, uring is set and the loop
+// only carries its settings; the ring does the watching.
+typedef struct EventLoop {
+    int epfd;
+    struct UringLoop *uring;
+    pthread_t thread;
+    WorkQueue *work_queue;
+    int timeout;
+    pthread_mutex_t mutex;
+    Connection *idle_head;        // sorted by deadline, soonest first
+    Connection *idle_tail;
+} EventLoop;
+
+// One listening socket and everything serving it: an acceptor, a work
+// queue with its workers, and event loops. With several listeners bound to
+// the same port (SO_REUSEPORT) these shards share nothing.
+typedef struct Listener {
+    int sockfd;
+    int port;
+    ThreadPool *pool;
+    EventLoop *loops;
+    int num_loops;
+    pthread_t acceptor;
+    struct UringLoop *uring;      // set when io_uring accepts and reads for this listener
+} Listener;
+
+void init_event_loop(EventLoop *loop, WorkQueue *queue, int timeout);
+void* event_loop_thread(void *arg);
+void event_loop_add(EventLoop *loop, Connection *conn);
+void event_loop_rearm(EventLoop *loop, Connection *conn);
+Connection* new_connection(int fd, struct sockaddr_in *addr, int server_port);
+void close_connection(Connection *conn);
+void expire_connection(Connection *conn);
+const char* connection_peer(Connection *conn);
+void shed_connection(Connection *conn);
+unsigned long shed_connections(void);
+
+extern const char overload_response[];
+extern const size_t overload_response_length;
+extern _Atomic unsigned long shed_count;
+long long now_ms(void);
+
+#endif
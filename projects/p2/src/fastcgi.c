@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
+#include "fastcgi.h"
+
+// Record types and constants from the FastCGI 1.0 specification.
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_LISTENSOCK_FILENO 0
+#define FCGI_HEADER_LEN 8
+#define FCGI_REQUEST_ID 1             // each connection carries one request at a time
+
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+static int append(Buffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(buffer->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+// Appends content as records of type, split at the record size limit. An
+// empty content appends the empty record that ends a stream.
+static int append_records(Buffer *buffer, int type, const unsigned char *content, size_t length) {
+    do {
+        size_t part = length < FCGI_RECORD_MAX ? length : FCGI_RECORD_MAX;
+        unsigned char header[FCGI_HEADER_LEN] = {
+            FCGI_VERSION_1, type, 0, FCGI_REQUEST_ID, part >> 8, part & 0xff, 0, 0
+        };
+        if (append(buffer, header, sizeof(header)) < 0 || append(buffer, content, part) < 0) {
+            return -1;
+        }
+        content += part;
+        length -= part;
+    } while (length > 0);
+    return 0;
+}
+
+// Name and value lengths take one byte below 128 and four bytes above.
+static int append_length(Buffer *buffer, size_t length) {
+    if (length < 128) {
+        unsigned char byte = length;
+        return append(buffer, &byte, 1);
+    }
+    unsigned char bytes[4] = { 0x80 | (length >> 24), length >> 16, length >> 8, length };
+    return append(buffer, bytes, 4);
+}
+
+static int send_all(int fd, const unsigned char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static ssize_t read_some(int fd, void *buf, size_t size) {
+    ssize_t n;
+    do {
+        n = read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static int read_exact(int fd, void *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = read_some(fd, buf, size);
+        if (n <= 0) {
+            return -1;
+        }
+        buf = (char *)buf + n;
+        size -= n;
+    }
+    return 0;
+}
+
+extern char **environ;
+
+// The pool whose processes are stopped when the server exits.
+static FcgiPool *spawned_pool;
+
+/**
+ * Starts one application process; it accepts its connections on fd 0.
+ * posix_spawn() rather than fork(), as processes are restarted from worker
+ * threads. Returns 0 if it cannot be started.
+ */
+static pid_t spawn_app(FcgiPool *pool) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pool->listen_fd, FCGI_LISTENSOCK_FILENO);
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+
+    pid_t pid;
+    const char *name = strrchr(pool->app, '/');
+    char *argv[] = { (char *)(name ? name + 1 : pool->app), NULL };
+    int error = posix_spawn(&pid, pool->app, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error) {
+        fprintf(stderr, "posix_spawn %s: %s\n", pool->app, strerror(error));
+        return 0;
+    }
+    return pid;
+}
+
+// The processes go down with the server rather than lingering in accept().
+static void stop_apps(void) {
+    pthread_mutex_lock(&spawned_pool->mutex);
+    for (int i = 0; i < spawned_pool->num_children; ++i) {
+        if (spawned_pool->children[i] > 0) {
+            kill(spawned_pool->children[i], SIGTERM);
+        }
+    }
+    pthread_mutex_unlock(&spawned_pool->mutex);
+}
+
+/**
+ * Restarts spawned processes that have exited, and retries slots whose
+ * process could not be started. A slot holds the pid, 0 while it has no
+ * process, or -1 while some thread is starting one; the starting happens
+ * outside the mutex, which the caller must not hold.
+ */
+static void respawn_exited(FcgiPool *pool) {
+    int slots[FCGI_MAX_PROCESSES];
+    int count = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (int i = 0; i < pool->num_children; ++i) {
+        pid_t pid = pool->children[i];
+        if (pid > 0 && waitpid(pid, NULL, WNOHANG) == pid) {
+            fprintf(stderr, "FastCGI process %d exited, restarting %s\n", (int)pid, pool->app);
+            pid = 0;
+        }
+        if (pid == 0) {
+            pool->children[i] = -1;
+            slots[count++] = i;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < count; ++i) {
+        pid_t pid = spawn_app(pool);
+        pthread_mutex_lock(&pool->mutex);
+        pool->children[slots[i]] = pid;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/**
+ * Sets up a pool for spec, either "unix:/path" for an application that
+ * already listens there, or the path of an application to start here with
+ * processes copies sharing one listening socket. processes also caps the
+ * connections open at once, so no request waits on a busy process while
+ * another one idles. Returns -1 with errno set on failure.
+ */
+int fcgi_pool_init(FcgiPool *pool, const char *spec, int processes) {
+    memset(pool, 0, sizeof(*pool));
+    if (processes < 1 || processes > FCGI_MAX_PROCESSES) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->available, NULL);
+    pool->max_open = processes;
+    pool->listen_fd = -1;
+    pool->address.sun_family = AF_UNIX;
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        size_t length = strlen(spec + 5);
+        if (length == 0 || length >= sizeof(pool->address.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(pool->address.sun_path, spec + 5, length + 1);
+        pool->address_length = offsetof(struct sockaddr_un, sun_path) + length + 1;
+        return 0;
+    }
+
+    if (access(spec, X_OK) < 0) {
+        return -1;
+    }
+    pool->app = strdup(spec);
+
+    // An abstract socket: nothing to clean up in the filesystem.
+    int length = snprintf(pool->address.sun_path + 1, sizeof(pool->address.sun_path) - 1, "icws-fastcgi-%d", (int)getpid());
+    pool->address_length = offsetof(struct sockaddr_un, sun_path) + 1 + length;
+    pool->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (pool->listen_fd < 0 ||
+        bind(pool->listen_fd, (struct sockaddr *)&pool->address, pool->address_length) < 0 ||
+        listen(pool->listen_fd, FCGI_MAX_PROCESSES) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < processes; ++i) {
+        pool->children[i] = spawn_app(pool);
+        if (pool->children[i] == 0) {
+            errno = ECHILD;
+            return -1;
+        }
+        pool->num_children++;
+    }
+    spawned_pool = pool;
+    atexit(stop_apps);
+    return 0;
+}
+
+// An idle connection, or a new one once fewer than max_open are in use.
+static int acquire(FcgiPool *pool, int *reused) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->num_idle == 0 && pool->open >= pool->max_open) {
+        pthread_cond_wait(&pool->available, &pool->mutex);
+    }
+    if (pool->num_idle > 0) {
+        int fd = pool->idle[--pool->num_idle];
+        pthread_mutex_unlock(&pool->mutex);
+        *reused = 1;
+        return fd;
+    }
+    pool->open++;
+    pthread_mutex_unlock(&pool->mutex);
+    if (pool->app) {
+        respawn_exited(pool);
+    }
+
+    *reused = 0;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&pool->address, pool->address_length) == 0) {
+        return fd;
+    }
+    perror("FastCGI connect");
+    if (fd >= 0) {
+        close(fd);
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->open--;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->mutex);
+    return -1;
+}
+
+static void release(FcgiPool *pool, int fd, int keep) {
+    if (!keep) {
+        close(fd);
+    }
+    pthread_mutex_lock(&pool->mutex);
+    if (keep) {
+        pool->idle[pool->num_idle++] = fd;
+    } else {
+        pool->open--;
+    }
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->mutex);
+    if (!keep && pool->app) {
+        respawn_exited(pool);
+    }
+}
+
+/**
+ * Sends a request with the CGI variables in envp ("NAME=value", NULL at
+ * the end) and body to the pool's application, all records in a single
+ * write. On success the response is read with fcgi_read() and the request
+ * finished with fcgi_end(); returns -1 if no process could take it.
+ */
+int fcgi_begin(FcgiPool *pool, FcgiRequest *request, char *const envp[], const char *body, size_t body_length) {
+    Buffer message = { NULL, 0, 0 };
+    Buffer pairs = { NULL, 0, 0 };
+    unsigned char begin[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+
+    int failed = append_records(&message, FCGI_BEGIN_REQUEST, begin, sizeof(begin));
+    for (int i = 0; envp[i] && !failed; ++i) {
+        const char *equals = strchr(envp[i], '=');
+        if (!equals) {
+            continue;
+        }
+        size_t name_length = equals - envp[i];
+        size_t value_length = strlen(equals + 1);
+        failed = append_length(&pairs, name_length) < 0 ||
+                 append_length(&pairs, value_length) < 0 ||
+                 append(&pairs, envp[i], name_length) < 0 ||
+                 append(&pairs, equals + 1, value_length) < 0;
+    }
+    failed = failed ||
+             (pairs.length > 0 && append_records(&message, FCGI_PARAMS, pairs.data, pairs.length) < 0) ||
+             append_records(&message, FCGI_PARAMS, NULL, 0) < 0 ||
+             (body_length > 0 && append_records(&message, FCGI_STDIN, (const unsigned char *)body, body_length) < 0) ||
+             append_records(&message, FCGI_STDIN, NULL, 0) < 0;
+    free(pairs.data);
+    if (failed) {
+        free(message.data);
+        return -1;
+    }
+
+    // A kept connection may have lost its process since; then the write
+    // fails and the request goes out again on a fresh one.
+    int fd = -1;
+    int reused = 1;
+    while (fd < 0 && reused) {
+        fd = acquire(pool, &reused);
+        if (fd < 0) {
+            break;
+        }
+        if (send_all(fd, message.data, message.length) < 0) {
+            release(pool, fd, 0);
+            fd = -1;
+        }
+    }
+    free(message.data);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->pool = pool;
+    request->fd = fd;
+    return 0;
+}
+
+/**
+ * Reads the next piece of the application's output (its FCGI_STDOUT
+ * stream) into buf. Anything on FCGI_STDERR is copied to the server's
+ * stderr on the way. Returns 0 once the request has ended and -1 if the
+ * connection broke.
+ */
+ssize_t fcgi_read(FcgiRequest *request, char *buf, size_t size) {
+    char discard[512];
+
+    while (!request->ended) {
+        if (request->type == FCGI_END_REQUEST && request->padding_left == 0) {
+            request->ended = 1;
+            break;
+        }
+        if (request->content_left > 0 && request->type == FCGI_STDOUT) {
+            ssize_t n = read_some(request->fd, buf, size < request->content_left ? size : request->content_left);
+            if (n <= 0) {
+                return -1;
+            }
+            request->content_left -= n;
+            return n;
+        }
+        if (request->content_left > 0 || request->padding_left > 0) {
+            size_t left = request->content_left > 0 ? request->content_left : request->padding_left;
+            ssize_t n = read_some(request->fd, discard, left < sizeof(discard) ? left : sizeof(discard));
+            if (n <= 0) {
+                return -1;
+            }
+            if (request->content_left > 0) {
+                if (request->type == FCGI_STDERR) {
+                    fwrite(discard, 1, n, stderr);
+                }
+                request->content_left -= n;
+            } else {
+                request->padding_left -= n;
+            }
+            continue;
+        }
+
+        unsigned char header[FCGI_HEADER_LEN];
+        if (read_exact(request->fd, header, sizeof(header)) < 0) {
+            return -1;
+        }
+        request->type = header[1];
+        request->content_left = (header[4] << 8) | header[5];
+        request->padding_left = header[6];
+        if (request->type == FCGI_END_REQUEST) {
+            // The app and protocol status, unused; the padding is skipped
+            // like any other.
+            if (request->content_left != 8 || read_exact(request->fd, discard, 8) < 0) {
+                return -1;
+            }
+            request->content_left = 0;
+        }
+    }
+    return 0;
+}
+
+// Hands the connection back for the next request if the response was read
+// to its end, and closes it otherwise.
+void fcgi_end(FcgiRequest *request) {
+    release(request->pool, request->fd, request->ended);
+}
@@ -0,0 +1,45 @@
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#define FCGI_MAX_PROCESSES 64         // app processes spawned, or connections to an external app
+#define FCGI_RECORD_MAX 65535         // content bytes in one record
+
+// Long-lived FastCGI application processes and the connections to them.
+// Each connection carries one request at a time and is kept open
+// (FCGI_KEEP_CONN) for the next one instead of forking per request.
+typedef struct FcgiPool {
+    struct sockaddr_un address;
+    socklen_t address_length;
+    char *app;                        // spawned application, NULL for an external one
+    int listen_fd;                    // the socket the spawned processes accept on
+    pid_t children[FCGI_MAX_PROCESSES];  // 0 without a process, -1 while one is started
+    int num_children;
+    pthread_mutex_t mutex;
+    pthread_cond_t available;
+    int idle[FCGI_MAX_PROCESSES];     // connections waiting for a request
+    int num_idle;
+    int open;                         // connections in use or idle
+    int max_open;
+} FcgiPool;
+
+// One request in flight on a pooled connection.
+typedef struct {
+    FcgiPool *pool;
+    int fd;
+    int ended;                        // FCGI_END_REQUEST has arrived
+    int type;                         // record being read and what is left of it
+    size_t content_left;
+    size_t padding_left;
+} FcgiRequest;
+
+int fcgi_pool_init(FcgiPool *pool, const char *spec, int processes);
+int fcgi_begin(FcgiPool *pool, FcgiRequest *request, char *const envp[], const char *body, size_t body_length);
+ssize_t fcgi_read(FcgiRequest *request, char *buf, size_t size);
+void fcgi_end(FcgiRequest *request);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fd_cache.h"
+#include "event_loop.h"
+
+void init_fd_cache(FdCache *cache, int max_fds) {
+    memset(cache, 0, sizeof(*cache));
+    for (int i = 0; i < FD_CACHE_SHARDS; ++i) {
+        pthread_mutex_init(&cache->shards[i].mutex, NULL);
+    }
+    cache->shard_limit = max_fds / FD_CACHE_SHARDS;
+    if (cache->shard_limit < 1) {
+        cache->shard_limit = 1;
+    }
+}
+
+static FdCacheShard* shard_for(FdCache *cache, uint64_t hash) {
+    return &cache->shards[hash % FD_CACHE_SHARDS];
+}
+
+static OpenFile** bucket_for(FdCacheShard *shard, uint64_t hash) {
+    return &shard->buckets[(hash / FD_CACHE_SHARDS) % FD_CACHE_BUCKETS];
+}
+
+// The descriptor is closed once the last reader is done with it.
+void fd_cache_release(OpenFile *file) {
+    if (atomic_fetch_sub(&file->refs, 1) == 1) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+// Caller holds the shard lock.
+static void unlink_file(FdCacheShard *shard, OpenFile *file) {
+    OpenFile **link = bucket_for(shard, file->hash);
+    while (*link && *link != file) {
+        link = &(*link)->chain;
+    }
+    if (*link) {
+        *link = file->chain;
+    }
+    lru_unlink(&shard->lru, &file->lru);
+    shard->count--;
+    fd_cache_release(file);
+}
+
+static OpenFile* find_file(FdCacheShard *shard, uint64_t hash, const char *path) {
+    for (OpenFile *file = *bucket_for(shard, hash); file; file = file->chain) {
+        if (file->hash == hash && strcmp(file->path, path) == 0) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/**
+ * Returns the open file for path with a reference the caller must drop
+ * with fd_cache_release(), or NULL on a miss. Within FD_CACHE_REVALIDATE_MS
+ * of the last check this costs no syscall at all; after that one stat()
+ * makes sure path still names the same, unchanged file.
+ */
+OpenFile* fd_cache_get(FdCache *cache, const char *path) {
+    uint64_t hash = hash_path(path);
+    FdCacheShard *shard = shard_for(cache, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    OpenFile *file = find_file(shard, hash, path);
+    if (file) {
+        atomic_fetch_add(&file->refs, 1);
+        lru_unlink(&shard->lru, &file->lru);
+        lru_push_front(&shard->lru, &file->lru);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (!file) {
+        return NULL;
+    }
+
+    long long now = now_ms();
+    if ((file->in_tree && atomic_load_explicit(&cache->watched, memory_order_relaxed)) ||
+        now - atomic_load_explicit(&file->checked, memory_order_relaxed) < FD_CACHE_REVALIDATE_MS) {
+        return file;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0 && same_file(&file->st, &st)) {
+        atomic_store_explicit(&file->checked, now, memory_order_relaxed);
+        return file;
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+    if (find_file(shard, hash, path) == file) {
+        unlink_file(shard, file);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    fd_cache_release(file);
+    return NULL;
+}
+
+/**
+ * Taken before a file is opened and handed to fd_cache_put(), so a change
+ * reported in between keeps the descriptor out of the cache.
+ */
+unsigned fd_cache_generation(FdCache *cache) {
+    return atomic_load(&cache->generation);
+}
+
+/**
+ * Adds an open regular file under path. The cache takes over fd and the
+ * returned entry is referenced as from fd_cache_get(). Returns NULL if
+ * the entry could not be allocated; fd then still belongs to the caller.
+ * If the tree changed since generation was taken the entry is only lent
+ * to the caller and closes fd on release.
+ */
+OpenFile* fd_cache_put(FdCache *cache, const char *path, int fd, const struct stat *st, int encodings, unsigned generation) {
+    size_t path_length = strlen(path);
+    OpenFile *file = malloc(sizeof(OpenFile) + path_length + 1);
+    if (!file) {
+        return NULL;
+    }
+
+    file->path = (char *)(file + 1);
+    memcpy(file->path, path, path_length + 1);
+    file->hash = hash_path(path);
+    file->fd = fd;
+    file->st = *st;
+    file->encodings = encodings;
+    file->in_tree = path_in_tree(path, cache->watched_root);
+    atomic_init(&file->checked, now_ms());
+    atomic_init(&file->refs, 2);
+    file->lru.prev = file->lru.next = NULL;
+
+    FdCacheShard *shard = shard_for(cache, file->hash);
+    pthread_mutex_lock(&shard->mutex);
+    if (atomic_load(&cache->generation) != generation) {
+        pthread_mutex_unlock(&shard->mutex);
+        atomic_store(&file->refs, 1);
+        return file;
+    }
+    OpenFile *old = find_file(shard, file->hash, path);
+    if (old) {
+        unlink_file(shard, old);
+    }
+    OpenFile **bucket = bucket_for(shard, file->hash);
+    file->chain = *bucket;
+    *bucket = file;
+    lru_push_front(&shard->lru, &file->lru);
+    shard->count++;
+    while (shard->count > cache->shard_limit && shard->lru.tail != &file->lru) {
+        unlink_file(shard, LRU_ENTRY(shard->lru.tail, OpenFile, lru));
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    return file;
+}
+
+/**
+ * Drops every entry whose file is called name, in whatever directory, or
+ * every entry at all if name is NULL; see path_has_name().
+ */
+void fd_cache_invalidate(FdCache *cache, const char *name) {
+    atomic_fetch_add(&cache->generation, 1);
+    for (int i = 0; i < FD_CACHE_SHARDS; ++i) {
+        FdCacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        OpenFile *file = LRU_ENTRY(shard->lru.head, OpenFile, lru);
+        while (file) {
+            OpenFile *next = LRU_ENTRY(file->lru.next, OpenFile, lru);
+            if (path_has_name(file->path, name)) {
+                unlink_file(shard, file);
+            }
+            file = next;
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
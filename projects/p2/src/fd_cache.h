@@ -0,0 +1,53 @@
+#ifndef FD_CACHE_H
+#define FD_CACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "cache_list.h"
+
+#define FD_CACHE_SHARDS 16
+#define FD_CACHE_BUCKETS 64           // hash buckets per shard
+#define FD_CACHE_REVALIDATE_MS 1000   // how long an fd is reused without a stat()
+
+// An open descriptor for a file too big for the memory cache, together
+// with its stat, keyed by the path the request maps to (root plus URI) as
+// given, not resolved. Readers only use offset-taking calls (sendfile, pread),
+// so any number of them can share the fd.
+typedef struct OpenFile {
+    uint64_t hash;
+    char *path;
+    int fd;
+    struct stat st;
+    int encodings;                    // sidecars next to the file, see probe_sidecars()
+    int in_tree;                      // resolves to a file under watched_root
+    _Atomic long long checked;        // monotonic ms of the last stat()
+    _Atomic int refs;                 // one for the cache while linked, one per reader
+    struct OpenFile *chain;           // next in the hash bucket
+    LruLink lru;
+} OpenFile;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    OpenFile *buckets[FD_CACHE_BUCKETS];
+    LruList lru;
+    int count;
+} FdCacheShard;
+
+typedef struct FdCache {
+    FdCacheShard shards[FD_CACHE_SHARDS];
+    int shard_limit;                  // open fds per shard
+    _Atomic int watched;              // inotify reports changes, so hits in_tree skip the stat()
+    char *watched_root;               // resolved --root, set before any worker starts
+    _Atomic unsigned generation;      // bumped by every invalidation
+} FdCache;
+
+void init_fd_cache(FdCache *cache, int max_fds);
+OpenFile* fd_cache_get(FdCache *cache, const char *path);
+unsigned fd_cache_generation(FdCache *cache);
+OpenFile* fd_cache_put(FdCache *cache, const char *path, int fd, const struct stat *st, int encodings, unsigned generation);
+void fd_cache_release(OpenFile *file);
+void fd_cache_invalidate(FdCache *cache, const char *name);
+
+#endif
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "file_cache.h"
+#include "event_loop.h"
+
+void init_file_cache(FileCache *cache, size_t budget) {
+    memset(cache, 0, sizeof(*cache));
+    for (int i = 0; i < CACHE_SHARDS; ++i) {
+        pthread_mutex_init(&cache->shards[i].mutex, NULL);
+    }
+    cache->shard_budget = budget / CACHE_SHARDS;
+    // A single file may take a quarter of its shard, so one big file
+    // cannot flush everything else.
+    cache->max_entry = cache->shard_budget / 4;
+}
+
+static CacheShard* shard_for(FileCache *cache, uint64_t hash) {
+    return &cache->shards[hash % CACHE_SHARDS];
+}
+
+static CacheEntry** bucket_for(CacheShard *shard, uint64_t hash) {
+    return &shard->buckets[(hash / CACHE_SHARDS) % CACHE_BUCKETS];
+}
+
+void file_cache_release(CacheEntry *entry) {
+    if (atomic_fetch_sub(&entry->refs, 1) == 1) {
+        free(entry);
+    }
+}
+
+// Drops the cache's reference. Readers still holding the entry keep it
+// alive until they release it. Caller holds the shard lock.
+static void unlink_entry(CacheShard *shard, CacheEntry *entry) {
+    CacheEntry **link = bucket_for(shard, entry->hash);
+    while (*link && *link != entry) {
+        link = &(*link)->chain;
+    }
+    if (*link) {
+        *link = entry->chain;
+    }
+    lru_unlink(&shard->lru, &entry->lru);
+    shard->bytes -= entry->charge;
+    file_cache_release(entry);
+}
+
+static CacheEntry* find_entry(CacheShard *shard, uint64_t hash, const char *path, int coding) {
+    for (CacheEntry *entry = *bucket_for(shard, hash); entry; entry = entry->chain) {
+        if (entry->hash == hash && entry->coding == coding && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static int same_file(const CacheEntry *entry, const struct stat *st) {
+    return S_ISREG(st->st_mode) &&
+           entry->dev == st->st_dev && entry->ino == st->st_ino &&
+           entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * Looks up path, as is or in the given coding, and returns the entry with
+ * a reference the caller must drop with file_cache_release(), or NULL on
+ * a miss. Within
+ * CACHE_REVALIDATE_MS of the last check a hit touches no file at all;
+ * after that one stat() confirms the file has not changed.
+ */
+CacheEntry* file_cache_get(FileCache *cache, const char *path, int coding) {
+    uint64_t hash = hash_path(path);
+    CacheShard *shard = shard_for(cache, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    CacheEntry *entry = find_entry(shard, hash, path, coding);
+    if (entry) {
+        atomic_fetch_add(&entry->refs, 1);
+        lru_unlink(&shard->lru, &entry->lru);
+        lru_push_front(&shard->lru, &entry->lru);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (!entry) {
+        return NULL;
+    }
+
+    long long now = now_ms();
+    if ((entry->in_tree && atomic_load_explicit(&cache->watched, memory_order_relaxed)) ||
+        now - atomic_load_explicit(&entry->checked, memory_order_relaxed) < CACHE_REVALIDATE_MS) {
+        return entry;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0 && same_file(entry, &st)) {
+        atomic_store_explicit(&entry->checked, now, memory_order_relaxed);
+        return entry;
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+    if (find_entry(shard, hash, path, coding) == entry) {
+        unlink_entry(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    file_cache_release(entry);
+    return NULL;
+}
+
+/**
+ * Taken before a file is opened and handed to file_cache_fill(), so a
+ * change reported while it was being read keeps the entry out.
+ */
+unsigned file_cache_generation(FileCache *cache) {
+    return atomic_load(&cache->generation);
+}
+
+// Allocates an entry with its path, ETag and prebuilt headers, and room
+// for a body of body_length bytes, all in one block. The caller fills in
+// the body and the file's identity.
+static CacheEntry* new_entry(const char *path, int coding, const char *validators, const char *etag, size_t body_length) {
+    char header[512];
+    int header_length = snprintf(header, sizeof(header),
+        "Content-Length: %zu\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s\r\n",
+        body_length, validators);
+    if (header_length < 0 || header_length >= (int)sizeof(header)) {
+        return NULL;
+    }
+
+    size_t path_length = strlen(path);
+    size_t etag_length = strlen(etag);
+    size_t charge = sizeof(CacheEntry) + path_length + 1 + etag_length + 1 + header_length + body_length;
+    CacheEntry *entry = malloc(charge);
+    if (!entry) {
+        return NULL;
+    }
+    char *path_copy = (char *)(entry + 1);
+    char *etag_copy = path_copy + path_length + 1;
+    char *header_copy = etag_copy + etag_length + 1;
+
+    memcpy(path_copy, path, path_length + 1);
+    memcpy(etag_copy, etag, etag_length + 1);
+    memcpy(header_copy, header, header_length);
+    entry->hash = hash_path(path);
+    entry->path = path_copy;
+    entry->coding = coding;
+    entry->etag = etag_copy;
+    entry->header = header_copy;
+    entry->header_length = header_length;
+    entry->body = header_copy + header_length;
+    entry->body_length = body_length;
+    entry->charge = charge;
+    atomic_init(&entry->checked, now_ms());
+    atomic_init(&entry->refs, 2);
+    entry->lru.prev = entry->lru.next = NULL;
+    return entry;
+}
+
+// Links entry in place of any older one for the same path and coding,
+// then trims the shard back to its budget. Caller holds the shard lock.
+static void link_entry(FileCache *cache, CacheShard *shard, CacheEntry *entry) {
+    CacheEntry *old = find_entry(shard, entry->hash, entry->path, entry->coding);
+    if (old) {
+        unlink_entry(shard, old);
+    }
+    CacheEntry **bucket = bucket_for(shard, entry->hash);
+    entry->chain = *bucket;
+    *bucket = entry;
+    lru_push_front(&shard->lru, &entry->lru);
+    shard->bytes += entry->charge;
+    while (shard->bytes > cache->shard_budget && shard->lru.tail != &entry->lru) {
+        unlink_entry(shard, LRU_ENTRY(shard->lru.tail, CacheEntry, lru));
+    }
+}
+
+/**
+ * Reads the open file into a new entry for path and returns it referenced
+ * as file_cache_get() does. Returns NULL if the file is not worth caching
+ * (too big, not regular) or could not be read in full. If the tree changed
+ * since generation was taken the entry is only lent to the caller.
+ */
+CacheEntry* file_cache_fill(FileCache *cache, const char *path, int fd, const struct stat *st, const char *validators, const char *etag, int encodings, unsigned generation) {
+    if (!S_ISREG(st->st_mode) || (size_t)st->st_size > cache->max_entry) {
+        return NULL;
+    }
+
+    CacheEntry *entry = new_entry(path, CODING_IDENTITY, validators, etag, st->st_size);
+    if (!entry) {
+        return NULL;
+    }
+
+    char *body = (char *)entry->body;
+    size_t done = 0;
+    while (done < (size_t)st->st_size) {
+        ssize_t n = pread(fd, body + done, st->st_size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(entry);
+            return NULL;
+        }
+        done += n;
+    }
+
+    entry->encodings = encodings;
+    entry->in_tree = path_in_tree(path, cache->watched_root);
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+
+    CacheShard *shard = shard_for(cache, entry->hash);
+    pthread_mutex_lock(&shard->mutex);
+    if (atomic_load(&cache->generation) != generation) {
+        pthread_mutex_unlock(&shard->mutex);
+        atomic_store(&entry->refs, 1);
+        return entry;
+    }
+    link_entry(cache, shard, entry);
+    pthread_mutex_unlock(&shard->mutex);
+
+    return entry;
+}
+
+/**
+ * Caches body as another coding of the file source holds, such as a gzip
+ * copy compressed from it, and returns it referenced as file_cache_get()
+ * does, or NULL if memory ran out. The copy is only kept while source is
+ * still the cached version of the file, so it cannot outlive a change;
+ * otherwise it is just lent to the caller.
+ */
+CacheEntry* file_cache_store(FileCache *cache, CacheEntry *source, int coding, const char *validators, const char *etag, const char *body, size_t body_length) {
+    CacheEntry *entry = new_entry(source->path, coding, validators, etag, body_length);
+    if (!entry) {
+        return NULL;
+    }
+
+    memcpy((char *)entry->body, body, body_length);
+    entry->encodings = source->encodings;
+    entry->in_tree = source->in_tree;
+    entry->dev = source->dev;
+    entry->ino = source->ino;
+    entry->size = source->size;
+    entry->mtime = source->mtime;
+
+    CacheShard *shard = shard_for(cache, entry->hash);
+    pthread_mutex_lock(&shard->mutex);
+    if (find_entry(shard, source->hash, source->path, CODING_IDENTITY) != source) {
+        pthread_mutex_unlock(&shard->mutex);
+        atomic_store(&entry->refs, 1);
+        return entry;
+    }
+    link_entry(cache, shard, entry);
+    pthread_mutex_unlock(&shard->mutex);
+
+    return entry;
+}
+
+/**
+ * Drops every entry whose file is called name, in whatever directory, or
+ * every entry at all if name is NULL; see path_has_name().
+ */
+void file_cache_invalidate(FileCache *cache, const char *name) {
+    atomic_fetch_add(&cache->generation, 1);
+    for (int i = 0; i < CACHE_SHARDS; ++i) {
+        CacheShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        CacheEntry *entry = LRU_ENTRY(shard->lru.head, CacheEntry, lru);
+        while (entry) {
+            CacheEntry *next = LRU_ENTRY(entry->lru.next, CacheEntry, lru);
+            if (path_has_name(entry->path, name)) {
+                unlink_entry(shard, entry);
+            }
+            entry = next;
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
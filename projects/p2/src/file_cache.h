@@ -0,0 +1,66 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "cache_list.h"
+
+#define CACHE_SHARDS 16
+#define CACHE_BUCKETS 256             // hash buckets per shard
+#define CACHE_REVALIDATE_MS 1000      // how long a hit is served without a stat()
+#define CODING_IDENTITY (-1)          // an entry holding the file as it is on disk
+
+// A whole file held in memory, or a compressed copy of it, with the part
+// of its response headers that does not change between requests.
+typedef struct CacheEntry {
+    uint64_t hash;
+    const char *path;
+    int coding;                       // CODING_IDENTITY, or an index into encodings[]
+    const char *header;               // Content-Length, Accept-Ranges, validators, blank line
+    const char *etag;
+    int encodings;                    // sidecars next to the file, see probe_sidecars()
+    int in_tree;                      // resolves to a file under watched_root
+    size_t header_length;
+    const char *body;
+    size_t body_length;
+    size_t charge;                    // bytes counted against the budget
+    dev_t dev;                        // identity of the file when it was read
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    _Atomic long long checked;        // monotonic ms of the last stat()
+    _Atomic int refs;                 // one for the cache while linked, one per reader
+    struct CacheEntry *chain;         // next in the hash bucket
+    LruLink lru;
+} CacheEntry;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    CacheEntry *buckets[CACHE_BUCKETS];
+    LruList lru;
+    size_t bytes;
+} CacheShard;
+
+// Split into shards by path hash so workers rarely contend on a lock.
+typedef struct FileCache {
+    CacheShard shards[CACHE_SHARDS];
+    size_t shard_budget;
+    size_t max_entry;                 // larger files are always served from disk
+    _Atomic int watched;              // inotify reports changes, so hits in_tree skip the stat()
+    char *watched_root;               // resolved --root, set before any worker starts
+    _Atomic unsigned generation;      // bumped by every invalidation
+} FileCache;
+
+void init_file_cache(FileCache *cache, size_t budget);
+CacheEntry* file_cache_get(FileCache *cache, const char *path, int coding);
+unsigned file_cache_generation(FileCache *cache);
+CacheEntry* file_cache_fill(FileCache *cache, const char *path, int fd, const struct stat *st, const char *validators, const char *etag, int encodings, unsigned generation);
+CacheEntry* file_cache_store(FileCache *cache, CacheEntry *source, int coding, const char *validators, const char *etag, const char *body, size_t body_length);
+void file_cache_release(CacheEntry *entry);
+void file_cache_invalidate(FileCache *cache, const char *name);
+
+#endif
@@ -0,0 +1,144 @@
+#include <string.h>
+#include "header_scan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef long (*scan_fn)(const char *buf, size_t from, size_t len);
+
+static int is_terminator(const char *p) {
+    return p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n';
+}
+
+// Returns the offset of the first "\r\n\r\n" starting in [from, len - 3),
+// or -1. Every candidate comes from memchr, which glibc already vectorizes.
+static long scan_scalar(const char *buf, size_t from, size_t len) {
+    while (from + 4 <= len) {
+        const char *cr = memchr(buf + from, '\r', len - 3 - from);
+        if (!cr) {
+            return -1;
+        }
+        if (is_terminator(cr)) {
+            return cr - buf;
+        }
+        from = cr - buf + 1;
+    }
+    return -1;
+}
+
+#if defined(__x86_64__)
+// The terminator starts at i exactly when bytes i..i+3 are CR LF CR LF, so
+// four shifted loads compared against CR/LF and ANDed together leave one
+// bit per match. Long runs without any CR, such as a big cookie, are skipped
+// 64 bytes at a time with a single compare per vector.
+static unsigned match_sse2(const char *p) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    __m128i m = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), cr),
+                      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), lf)),
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), cr),
+                      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 3)), lf)));
+    return _mm_movemask_epi8(m);
+}
+
+static long scan_sse2(const char *buf, size_t from, size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    size_t i = from;
+
+    for (; i + 64 + 3 <= len; i += 64) {
+        __m128i any = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), cr),
+                         _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 16)), cr)),
+            _mm_or_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 32)), cr),
+                         _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 48)), cr)));
+        if (!_mm_movemask_epi8(any)) {
+            continue;
+        }
+        for (size_t j = i; j < i + 64; j += 16) {
+            unsigned mask = match_sse2(buf + j);
+            if (mask) {
+                return j + __builtin_ctz(mask);
+            }
+        }
+    }
+    for (; i + 16 + 3 <= len; i += 16) {
+        unsigned mask = match_sse2(buf + i);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_scalar(buf, i, len);
+}
+
+__attribute__((target("avx2")))
+static unsigned match_avx2(const char *p) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    __m256i m = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), cr),
+                         _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), lf)),
+        _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)), cr),
+                         _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 3)), lf)));
+    return _mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static long scan_avx2(const char *buf, size_t from, size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    size_t i = from;
+
+    for (; i + 64 + 3 <= len; i += 64) {
+        __m256i any = _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), cr),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 32)), cr));
+        if (!_mm256_movemask_epi8(any)) {
+            continue;
+        }
+        unsigned mask = match_avx2(buf + i);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+        mask = match_avx2(buf + i + 32);
+        if (mask) {
+            return i + 32 + __builtin_ctz(mask);
+        }
+    }
+    return scan_sse2(buf, i, len);
+}
+#endif
+
+static scan_fn scan = scan_scalar;
+
+// Picked once at startup, before any worker thread exists.
+__attribute__((constructor))
+static void pick_scanner(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    scan = __builtin_cpu_supports("avx2") ? scan_avx2 : scan_sse2;
+#endif
+}
+
+/**
+ * Looks for the blank line ending a request head in place. Returns the head
+ * length (up to and including the "\r\n\r\n") or -1 if it is not there yet.
+ *
+ * If scanned is given, the search starts at *scanned and, on failure, *scanned
+ * is moved to where the next search over a longer buffer has to begin, so
+ * bytes are only examined once however the head trickles in. Reset it to 0
+ * when a new request starts.
+ */
+long find_header_end(const char *buf, size_t len, size_t *scanned) {
+    size_t from = scanned ? *scanned : 0;
+    long at = scan(buf, from, len);
+
+    if (at < 0) {
+        if (scanned) {
+            // The last three bytes may still begin a terminator.
+            *scanned = len > from + 3 ? len - 3 : from;
+        }
+        return -1;
+    }
+    return at + 4;
+}
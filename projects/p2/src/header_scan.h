@@ -0,0 +1,8 @@
+#ifndef HEADER_SCAN_H
+#define HEADER_SCAN_H
+
+#include <stddef.h>
+
+long find_header_end(const char *buf, size_t len, size_t *scanned);
+
+#endif
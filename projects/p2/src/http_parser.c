@@ -0,0 +1,215 @@
+#include "http_parser.h"
+
+enum {
+    S_METHOD_START = 0,
+    S_METHOD,
+    S_URI_START,
+    S_URI,
+    S_VERSION_START,
+    S_VERSION,
+    S_REQUEST_LINE_LF,
+    S_HEADER_START,
+    S_HEADER_NAME,
+    S_VALUE_START,
+    S_VALUE,
+    S_HEADER_LF,
+    S_END_LF,
+    S_DONE,
+    S_ERROR
+};
+
+#define C_TOKEN 1   // method and header name characters (RFC 7230 tchar)
+#define C_VCHAR 2   // visible characters, allowed in the URI and version
+#define C_FIELD 4   // header value characters, obs-text included
+
+static const unsigned char char_class[256] = {
+    [0x21 ... 0x7e] = C_TOKEN | C_VCHAR | C_FIELD,
+    ['('] = C_VCHAR | C_FIELD, [')'] = C_VCHAR | C_FIELD,
+    ['<'] = C_VCHAR | C_FIELD, ['>'] = C_VCHAR | C_FIELD,
+    ['@'] = C_VCHAR | C_FIELD, [','] = C_VCHAR | C_FIELD,
+    [';'] = C_VCHAR | C_FIELD, [':'] = C_VCHAR | C_FIELD,
+    ['\\'] = C_VCHAR | C_FIELD, ['"'] = C_VCHAR | C_FIELD,
+    ['/'] = C_VCHAR | C_FIELD, ['['] = C_VCHAR | C_FIELD,
+    [']'] = C_VCHAR | C_FIELD, ['?'] = C_VCHAR | C_FIELD,
+    ['='] = C_VCHAR | C_FIELD, ['{'] = C_VCHAR | C_FIELD,
+    ['}'] = C_VCHAR | C_FIELD,
+    [0x80 ... 0xff] = C_FIELD,
+};
+
+#define IS(ch, class) (char_class[(unsigned char)(ch)] & (class))
+
+void http_parser_init(HttpParser *parser) {
+    parser->state = S_METHOD_START;
+    parser->pos = 0;
+    parser->mark = 0;
+    parser->value_end = 0;
+    parser->header_count = 0;
+}
+
+static Slice slice(size_t start, size_t end) {
+    Slice s = { start, end - start };
+    return s;
+}
+
+/**
+ * Scans buf[parser->pos .. len). Returns HTTP_PARSE_DONE once the blank line
+ * ending the head has been seen (parser->pos is then the head length),
+ * HTTP_PARSE_AGAIN if the head is still incomplete, or HTTP_PARSE_ERROR.
+ * Line endings must be CRLF and obsolete line folding is rejected.
+ */
+int http_parser_execute(HttpParser *parser, const char *buf, size_t len) {
+    int state = parser->state;
+    size_t i = parser->pos;
+
+    if (state == S_DONE) {
+        return HTTP_PARSE_DONE;
+    }
+    if (state == S_ERROR) {
+        return HTTP_PARSE_ERROR;
+    }
+
+    for (; i < len; ++i) {
+        char ch = buf[i];
+
+        switch (state) {
+            case S_METHOD_START:
+                if (!IS(ch, C_TOKEN)) {
+                    goto error;
+                }
+                parser->mark = i;
+                state = S_METHOD;
+                break;
+
+            case S_METHOD:
+                // Stay in the tight loop for the common run of token characters.
+                while (IS(ch, C_TOKEN) && i + 1 < len) {
+                    ch = buf[++i];
+                }
+                if (IS(ch, C_TOKEN)) {
+                    break;
+                }
+                if (ch != ' ') {
+                    goto error;
+                }
+                parser->method = slice(parser->mark, i);
+                state = S_URI_START;
+                break;
+
+            case S_URI_START:
+            case S_VERSION_START:
+                if (!IS(ch, C_VCHAR)) {
+                    goto error;
+                }
+                parser->mark = i;
+                state = state == S_URI_START ? S_URI : S_VERSION;
+                break;
+
+            case S_URI:
+                while (IS(ch, C_VCHAR) && i + 1 < len) {
+                    ch = buf[++i];
+                }
+                if (IS(ch, C_VCHAR)) {
+                    break;
+                }
+                if (ch != ' ') {
+                    goto error;
+                }
+                parser->uri = slice(parser->mark, i);
+                state = S_VERSION_START;
+                break;
+
+            case S_VERSION:
+                if (IS(ch, C_VCHAR)) {
+                    break;
+                }
+                if (ch != '\r') {
+                    goto error;
+                }
+                parser->version = slice(parser->mark, i);
+                state = S_REQUEST_LINE_LF;
+                break;
+
+            case S_REQUEST_LINE_LF:
+            case S_HEADER_LF:
+                if (ch != '\n') {
+                    goto error;
+                }
+                if (state == S_HEADER_LF) {
+                    parser->headers[parser->header_count].value = slice(parser->mark, parser->value_end);
+                    parser->header_count++;
+                }
+                state = S_HEADER_START;
+                break;
+
+            case S_HEADER_START:
+                if (ch == '\r') {
+                    state = S_END_LF;
+                    break;
+                }
+                if (!IS(ch, C_TOKEN) || parser->header_count == HTTP_MAX_HEADERS) {
+                    goto error;
+                }
+                parser->mark = i;
+                state = S_HEADER_NAME;
+                break;
+
+            case S_HEADER_NAME:
+                while (IS(ch, C_TOKEN) && i + 1 < len) {
+                    ch = buf[++i];
+                }
+                if (IS(ch, C_TOKEN)) {
+                    break;
+                }
+                if (ch != ':') {
+                    goto error;
+                }
+                parser->headers[parser->header_count].name = slice(parser->mark, i);
+                state = S_VALUE_START;
+                break;
+
+            case S_VALUE_START:
+                if (ch == ' ' || ch == '\t') {
+                    break;
+                }
+                parser->mark = i;
+                parser->value_end = i;
+                if (ch == '\r') {
+                    state = S_HEADER_LF;
+                    break;
+                }
+                if (!IS(ch, C_FIELD)) {
+                    goto error;
+                }
+                parser->value_end = i + 1;
+                state = S_VALUE;
+                break;
+
+            case S_VALUE:
+                if (ch == '\r') {
+                    state = S_HEADER_LF;
+                } else if (IS(ch, C_FIELD)) {
+                    parser->value_end = i + 1;
+                } else if (ch != ' ' && ch != '\t') {
+                    goto error;
+                }
+                break;
+
+            case S_END_LF:
+                if (ch != '\n') {
+                    goto error;
+                }
+                parser->state = S_DONE;
+                parser->pos = i + 1;
+                return HTTP_PARSE_DONE;
+        }
+    }
+
+    parser->state = state;
+    parser->pos = i;
+    return HTTP_PARSE_AGAIN;
+
+error:
+    parser->state = S_ERROR;
+    parser->pos = i;
+    return HTTP_PARSE_ERROR;
+}
@@ -0,0 +1,41 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+
+#define HTTP_MAX_HEADERS 64
+
+#define HTTP_PARSE_DONE 0
+#define HTTP_PARSE_AGAIN 1
+#define HTTP_PARSE_ERROR -1
+
+// A run of bytes in the caller's buffer. Kept as an offset rather than a
+// pointer so it stays valid while more data is appended behind it.
+typedef struct {
+    size_t offset;
+    size_t length;
+} Slice;
+
+typedef struct {
+    Slice name;
+    Slice value;
+} HeaderSlice;
+
+// Incremental request-head parser. Feed it the same buffer again whenever
+// more bytes arrive; it picks up where it stopped instead of rescanning.
+typedef struct {
+    int state;
+    size_t pos;                   // bytes examined so far; the head length once done
+    size_t mark;                  // start of the element being scanned
+    size_t value_end;             // end of the header value without trailing whitespace
+    Slice method;
+    Slice uri;
+    Slice version;
+    HeaderSlice headers[HTTP_MAX_HEADERS];
+    int header_count;
+} HttpParser;
+
+void http_parser_init(HttpParser *parser);
+int http_parser_execute(HttpParser *parser, const char *buf, size_t len);
+
+#endif
@@ -1,494 +1,2098 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <string.h>
-#include <getopt.h>
-#include <signal.h>
-#include <ctype.h>
-#include <sys/wait.h>
-#include <arpa/inet.h> 
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <pthread.h>
-#include <time.h>
-#include <poll.h>
-#include "thread_pool.h"
-#include "parse.h"
-
-#define DEFAULT_PORT 8080
-#define MAX_BACKLOG 10
-#define BUFFER_SIZE 8192
-#define DEFAULT_NUM_THREADS 4
-#define DEFAULT_QUEUE_CAPACITY 100
-#define DEFAULT_TIMEOUT_DURATION 5000
-
-void signal_handler(int signum);
-void start_server(int port, const char *wwwroot, ThreadPool *threadPool);
-void handle_connection(int sock, const char *wwwroot, int timeout, const char *cgi_base_path, const char *client_ip, int server_port);
-const char* get_content_type(const char *path);
-void send_response(int sock, const char *status, const char *content_type, const char *body, size_t body_length);
-void enqueue_work(WorkQueue* queue, int socket_fd);
-WorkItem dequeue_work(WorkQueue* queue);
-void handle_cgi_request(int sock, const char *cgi_script_path, Request *request, const char *client_ip, int server_port);
-
-int main(int argc, char *argv[]) {
-    int port = DEFAULT_PORT;
-    char *wwwroot = NULL;
-    int numThreads = DEFAULT_NUM_THREADS;
-    int timeout = DEFAULT_TIMEOUT_DURATION; 
-    char *cgi_script_path = NULL;
-
-    struct option long_options[] = {
-        {"port", required_argument, 0, 'p'},
-        {"root", required_argument, 0, 'r'},
-        {"numThreads", required_argument, 0, 'n'},
-        {"timeout", required_argument, 0, 't'},
-        {"cgiHandler", required_argument, 0, 'c'},
-        {0, 0, 0, 0}
-    };
-
-    int opt;
-    while ((opt = getopt_long(argc, argv, "p:r:n:t:c:", long_options, NULL)) != -1) {
-        switch (opt) {
-            case 'p':
-                port = atoi(optarg);
-                break;
-            case 'r':
-                wwwroot = strdup(optarg);
-                break;
-            case 'n':
-                numThreads = atoi(optarg);
-                break;
-            case 't':
-                timeout = atoi(optarg) * 1000; 
-                break;
-            case 'c':
-                cgi_script_path = strdup(optarg);
-                break;
-            default:
-                exit(EXIT_FAILURE);
-        }
-    }
-
-    if (!wwwroot) {
-        fprintf(stderr, "wwwroot directory is required\n");
-        exit(EXIT_FAILURE);
-    }
-    if (cgi_script_path == NULL) {
-        fprintf(stderr, "CGI handler script path is required\n");
-        exit(EXIT_FAILURE);
-    }
-
-    signal(SIGINT, signal_handler);
-
-    ThreadPool *threadPool = malloc(sizeof(ThreadPool));
-    if (!threadPool) {
-        perror("Failed to allocate memory for ThreadPool");
-        exit(EXIT_FAILURE);
-    }
-
-    threadPool->work_queue = malloc(sizeof(WorkQueue));
-    if (!threadPool->work_queue) {
-        perror("Failed to allocate memory for WorkQueue");
-        exit(EXIT_FAILURE);
-    }
-
-    init_work_queue(threadPool->work_queue, DEFAULT_QUEUE_CAPACITY);
-    init_thread_pool(threadPool, numThreads, threadPool->work_queue, wwwroot, timeout, cgi_script_path);
-
-    start_server(port, wwwroot, threadPool);
-
-    free(wwwroot);
-    for (int i = 0; i < numThreads; ++i) {
-        pthread_join(threadPool->threads[i], NULL);
-    }
-    free(threadPool->work_queue->items);
-    free(threadPool->work_queue);
-    free(threadPool);
-
-    if (cgi_script_path) {
-        free(cgi_script_path);
-    }
-
-    return 0;
-}
-
-
-void init_work_queue(WorkQueue* queue, int capacity) {
-    queue->items = (WorkItem*)malloc(sizeof(WorkItem) * capacity);
-    queue->capacity = capacity;
-    queue->count = 0;
-    queue->front = 0;
-    queue->rear = -1;
-    pthread_mutex_init(&queue->mutex, NULL);
-    pthread_cond_init(&queue->cond_var, NULL);
-}
-
-
-void* worker_thread(void* arg) {
-    WorkerArgs *workerArgs = (WorkerArgs *)arg;
-    WorkQueue *queue = workerArgs->workQueue;
-    char *wwwRoot = workerArgs->wwwRoot;
-    int timeout = workerArgs->timeout;
-    char *cgi_script_path = workerArgs->cgi_script_path;
-
-    while (1) {
-        pthread_mutex_lock(&queue->mutex);
-
-        while (queue->count == 0) {
-            pthread_cond_wait(&queue->cond_var, &queue->mutex);
-        }
-
-        WorkItem item = dequeue_work(queue);
-        pthread_mutex_unlock(&queue->mutex);
-
-        struct pollfd fd;
-        fd.fd = item.socket_fd;
-        fd.events = POLLIN;
-        int ret = poll(&fd, 1, timeout);
-
-        if (ret > 0) {
-            struct sockaddr_in addr;
-            socklen_t addr_len = sizeof(addr);
-            getpeername(item.socket_fd, (struct sockaddr *)&addr, &addr_len);
-            int server_port = ntohs(addr.sin_port);
-
-            handle_connection(item.socket_fd, wwwRoot, timeout, cgi_script_path, inet_ntoa(addr.sin_addr), server_port);
-        } else if (ret == 0) {
-            printf("Connection timed out (socket fd: %d).\n", item.socket_fd);
-            send_response(item.socket_fd, "408 Request Timeout", "text/html", "<h1>408 Request Timeout</h1>", 26);
-        } else {
-            perror("Poll error");
-        }
-
-        close(item.socket_fd);
-    }
-
-    free(wwwRoot);
-    if (cgi_script_path) {
-        free(cgi_script_path);
-    }
-    free(workerArgs);
-
-    return NULL;
-}
-
-
-void init_thread_pool(ThreadPool* pool, int num_threads, WorkQueue* queue, char *wwwRoot, int timeout, char *cgi_script_path) {
-    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
-    pool->thread_count = num_threads;
-    pool->work_queue = queue;
-
-    for (int i = 0; i < num_threads; ++i) {
-        WorkerArgs *workerArgs = malloc(sizeof(WorkerArgs));
-        workerArgs->workQueue = queue;
-        workerArgs->wwwRoot = strdup(wwwRoot);
-        workerArgs->timeout = timeout;
-        workerArgs->cgi_script_path = cgi_script_path ? strdup(cgi_script_path) : NULL;
-
-        pthread_create(&pool->threads[i], NULL, worker_thread, workerArgs);
-    }
-}
-
-
-
-void enqueue_work(WorkQueue* queue, int socket_fd) {
-    pthread_mutex_lock(&queue->mutex);
-
-    if (queue->count < queue->capacity) {
-        queue->rear = (queue->rear + 1) % queue->capacity;
-        queue->items[queue->rear].socket_fd = socket_fd;
-        queue->count++;
-
-        pthread_cond_signal(&queue->cond_var);
-    }
-
-    pthread_mutex_unlock(&queue->mutex);
-}
-
-WorkItem dequeue_work(WorkQueue* queue) {
-    WorkItem item = queue->items[queue->front];
-    queue->front = (queue->front + 1) % queue->capacity;
-    queue->count--;
-
-    return item;
-}
-
-void free_request(Request *request) {
-    if (request != NULL) {
-        if (request->headers) {
-            free(request->headers); 
-        }
-        if (request->body) {
-            free(request->body); 
-        }
-        free(request);
-    }
-}
-
-
-void signal_handler(int signum) {
-    printf("\nReceived signal %d. Shutting down...\n", signum);
-    exit(signum);
-}
-
-void start_server(int port, const char *wwwroot, ThreadPool *threadPool){
-    int sockfd, newsockfd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t clilen;
-
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("ERROR opening socket");
-        exit(EXIT_FAILURE);
-    }
-
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
-
-    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("ERROR on binding");
-        close(sockfd);
-        exit(EXIT_FAILURE);
-    }
-
-    listen(sockfd, MAX_BACKLOG);
-    printf("Server is listening on port %d...\n", port);
-
-    clilen = sizeof(client_addr);
-    while (1) {
-        newsockfd = accept(sockfd, (struct sockaddr *)&client_addr, &clilen);
-        if (newsockfd < 0) {
-            perror("ERROR on accept");
-            continue;
-        }
-
-        enqueue_work(threadPool->work_queue, newsockfd);
-    }
-
-    close(sockfd);
-}
-
-void handle_connection(int sock, const char *wwwroot, int timeout, const char *cgi_base_path, const char *client_ip, int server_port) {
-    char buffer[BUFFER_SIZE];
-    int nbytes;
-
-    nbytes = read(sock, buffer, BUFFER_SIZE - 1);
-    if (nbytes < 0) {
-        perror("ERROR reading from socket");
-        return;
-    }
-
-    buffer[nbytes] = '\0';
-
-    Request *request = parse(buffer, nbytes, sock);
-    if (request == NULL) {
-        send_response(sock, "400 Bad Request", "text/html", "<h1>400 Bad Request</h1>", 25);
-        return;
-    }
-
-    if (strcmp(request->http_method, "GET") != 0 && strcmp(request->http_method, "HEAD") != 0 && strcmp(request->http_method, "POST") != 0) {
-        send_response(sock, "501 Not Implemented", "text/html", "<h1>501 Not Implemented</h1>", 27);
-        free_request(request);
-        return;
-    }
-
-    if (strcmp(request->http_version, "HTTP/1.1") != 0) {
-        send_response(sock, "505 HTTP Version Not Supported", "text/html", "<h1>505 HTTP Version Not Supported</h1>", 37);
-        free_request(request);
-        return;
-    }
-
-    if (strncmp(request->http_uri, "/cgi/", 5) == 0) {
-        char cgi_script_path[4096];
-        snprintf(cgi_script_path, sizeof(cgi_script_path), "%s%s", cgi_base_path, request->http_uri + 5);
-        printf("CGI script path: %s\n", cgi_script_path);
-        handle_cgi_request(sock, cgi_script_path, request, client_ip, server_port);
-    } 
-    
-    else {
-        char filepath[8192];
-        snprintf(filepath, sizeof(filepath), "%s%s", wwwroot, request->http_uri);
-
-        FILE *file = fopen(filepath, "rb");
-        if (file == NULL) {
-            send_response(sock, "404 Not Found", "text/html", "<h1>404 Not Found</h1>", 22);
-        } 
-        
-        else {
-            fseek(file, 0, SEEK_END);
-            long file_size = ftell(file);
-            fseek(file, 0, SEEK_SET);
-
-            char *file_content = malloc(file_size);
-            if (file_content == NULL) {
-                send_response(sock, "500 Internal Server Error", "text/html", "<h1>500 Internal Server Error</h1>", 30);
-                fclose(file);
-            } 
-            
-            else {
-                fread(file_content, 1, file_size, file);
-                fclose(file);
-                send_response(sock, "200 OK", get_content_type(filepath), file_content, file_size);
-                free(file_content);
-            }
-        }
-    }
-
-    free_request(request);
-}
-
-void handle_cgi_request(int sock, const char *cgi_script_path, Request *request, const char *client_ip, int server_port) {
-    int c2pFds[2]; 
-    int p2cFds[2]; 
-    char buffer[4096];
-    ssize_t nread;
-
-    if (pipe(c2pFds) == -1 || pipe(p2cFds) == -1) {
-        perror("pipe");
-        send_response(sock, "500 Internal Server Error", "text/html", "<h1>500 Internal Server Error</h1>", 30);
-        return;
-    }
-
-    pid_t pid = fork();
-
-    if (pid == -1) {
-        perror("fork");
-        send_response(sock, "500 Internal Server Error", "text/html", "<h1>500 Internal Server Error</h1>", 30);
-        close(c2pFds[0]);
-        close(c2pFds[1]);
-        close(p2cFds[0]);
-        close(p2cFds[1]);
-        return;
-    }
-
-    if (pid == 0) { 
-        close(c2pFds[0]);
-        close(p2cFds[1]);
-        if (dup2(p2cFds[0], STDIN_FILENO) == -1 || dup2(c2pFds[1], STDOUT_FILENO) == -1) {
-            perror("dup2");
-            exit(EXIT_FAILURE);
-        }
-        close(p2cFds[0]);
-        close(c2pFds[1]);
-
-        setenv("GATEWAY_INTERFACE", "CGI/1.1", 1);
-        setenv("REQUEST_METHOD", request->http_method, 1);
-        setenv("QUERY_STRING", request->query_string, 1);
-        setenv("CONTENT_LENGTH", request->content_length, 1);
-        setenv("CONTENT_TYPE", request->content_type, 1);
-        setenv("REMOTE_ADDR", client_ip, 1);
-        setenv("REQUEST_URI", request->http_uri, 1);
-        char server_port_str[6];
-        snprintf(server_port_str, sizeof(server_port_str), "%d", server_port);
-        setenv("SERVER_PORT", server_port_str, 1);
-        setenv("SERVER_PROTOCOL", "HTTP/1.1", 1);
-        setenv("SERVER_SOFTWARE", "MyHTTPServer/1.0", 1);
-
-        char script_name[8192];
-        char *query_string_start = strchr(cgi_script_path, '?');
-        if (query_string_start) {
-            int script_name_len = query_string_start - cgi_script_path;
-            strncpy(script_name, cgi_script_path, script_name_len);
-            script_name[script_name_len] = '\0';
-            setenv("QUERY_STRING", query_string_start + 1, 1); 
-        } else {
-            strncpy(script_name, cgi_script_path, sizeof(script_name));
-            setenv("QUERY_STRING", "", 1);
-        }
-
-        setenv("SCRIPT_NAME", script_name, 1);
-        setenv("PATH_INFO", "", 1); 
-
-        for (int i = 0; i < request->header_count; i++) {
-            if (strcasecmp(request->headers[i].header_name, "Accept") == 0) {
-                setenv("HTTP_ACCEPT", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Referer") == 0) {
-                setenv("HTTP_REFERER", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Accept-Encoding") == 0) {
-                setenv("HTTP_ACCEPT_ENCODING", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Accept-Language") == 0) {
-                setenv("HTTP_ACCEPT_LANGUAGE", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Accept-Charset") == 0) {
-                setenv("HTTP_ACCEPT_CHARSET", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Host") == 0) {
-                setenv("HTTP_HOST", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Cookie") == 0) {
-                setenv("HTTP_COOKIE", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "User-Agent") == 0) {
-                setenv("HTTP_USER_AGENT", request->headers[i].header_value, 1);
-            } else if (strcasecmp(request->headers[i].header_name, "Connection") == 0) {
-                setenv("HTTP_CONNECTION", request->headers[i].header_value, 1);
-            }
-        }
-
-        char *base_name = strrchr(script_name, '/');
-        if (base_name) {
-            base_name++; 
-        } else {
-            base_name = script_name;
-        }
-
-        execl(script_name, base_name, NULL);
-        perror("execl");
-        exit(EXIT_FAILURE);
-    } 
-    else { 
-        close(c2pFds[1]);
-        close(p2cFds[0]);
-
-        if (strcmp(request->http_method, "POST") == 0) {
-            write(p2cFds[1], request->body, request->body_length);
-        }
-        close(p2cFds[1]);
-
-        while ((nread = read(c2pFds[0], buffer, sizeof(buffer))) > 0) {
-            send(sock, buffer, nread, 0);
-        }
-        close(c2pFds[0]);
-
-        waitpid(pid, NULL, 0);
-    }
-}
-
-
-const char* get_content_type(const char *path) {
-    const char *dot = strrchr(path, '.');
-    if (!dot) return "text/plain";
-
-    if (strcmp(dot, ".html") == 0 || strcmp(dot, ".htm") == 0) return "text/html";
-    else if (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0) return "image/jpeg";
-    else if (strcmp(dot, ".css") == 0) return "text/css";
-    else if (strcmp(dot, ".js") == 0) return "application/javascript";
-    else if (strcmp(dot, ".png") == 0) return "image/png";
-    else if (strcmp(dot, ".js") == 0) return "text/javascript";
-    else if (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0) return "image/jpg";
-    else if (strcmp(dot, ".gif") == 0) return "image/gif";
-    else return "text/plain";
-}
-
-void send_response(int sock, const char *status, const char *content_type, const char *body, size_t body_length) {
-    char header[2048];
-    time_t now = time(0);
-    struct tm *gmt = gmtime(&now);
-    char date[128];
-    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmt);
-
-    int header_length = snprintf(header, sizeof(header),
-        "HTTP/1.1 %s\r\n"
-        "Date: %s\r\n"
-        "Server: MyHTTPServer/1.0 (Unix)\r\n"
-        "Connection: close\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %zu\r\n"
-        "\r\n",
-        status, date, content_type, body_length);
-
-    write(sock, header, header_length);
-    if (body && body_length > 0) {
-        write(sock, body, body_length);
-    }
-}
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <ctype.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <arpa/inet.h> 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include "thread_pool.h"
+#include "event_loop.h"
+#include "parse.h"
+#include "header_scan.h"
+#include "uring.h"
+#include "file_cache.h"
+#include "fd_cache.h"
+#include "root_watch.h"
+#include "encoding.h"
+#include "compress.h"
+#include "fastcgi.h"
+#include "zygote.h"
+#include "cgi_loop.h"
+
+#define DEFAULT_PORT 8080
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_NUM_THREADS 4
+#define DEFAULT_QUEUE_CAPACITY 100
+#define DEFAULT_TIMEOUT_DURATION 5000
+#define DEFAULT_KEEP_ALIVE_TIMEOUT 5000
+#define DEFAULT_MAX_REQUESTS 100
+#define DEFAULT_CACHE_SIZE (64 << 20)
+#define DEFAULT_FD_CACHE_SIZE 256
+#define DEFAULT_FASTCGI_PROCESSES 4
+#define STREAM_CHUNK_SIZE 65536
+#define MAX_RANGES 16                 // a Range header asking for more is ignored
+#define CONTENT_LENGTH_UNKNOWN (-2)   // for send_headers(): HEAD when only GET would know
+#define GZIP_CODING "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"
+
+typedef struct {
+    off_t first;
+    off_t last;
+} ByteRange;
+
+#define CGI_MAX_VARS (16 + REQUEST_MAX_HEADERS)
+
+// A script's environment, built in the server before the script starts.
+typedef struct {
+    char *vars[CGI_MAX_VARS + 1];     // NAME=value strings in strings, NULL-terminated
+    int count;
+    char strings[16384];
+    size_t used;
+} CgiEnv;
+
+void signal_handler(int signum);
+int open_listener(int port, int backlog, int reuse_port);
+void* accept_connections(void *arg);
+int handle_connection(Connection *conn, WorkerArgs *args);
+int handle_request(Connection *conn, Request *request, int keep_alive, WorkerArgs *args);
+int serve_static(int sock, Request *request, const char *filepath, const char *content_type, const Encoding *encoding, int keep_alive, WorkerArgs *args);
+int serve_variant(int sock, Request *request, const char *filepath, const char *content_type, int chosen, int keep_alive, WorkerArgs *args);
+int serve_gzip(int sock, Request *request, CacheEntry *source, const char *content_type, int conditional, int keep_alive, WorkerArgs *args);
+int wants_gzip(Request *request, const char *content_type, off_t size);
+void format_gzip_etag(char *buf, size_t size, const char *etag);
+int send_head(int sock, Request *request, const char *filepath, const struct stat *st, const char *content_type, const char *coding, int may_compress, int keep_alive, WorkerArgs *args);
+int wants_keep_alive(Request *request);
+const char* get_content_type(const char *path);
+void send_response(int sock, const char *status, const char *content_type, const char *body, size_t body_length, int keep_alive);
+void send_error(int sock, const char *status, int keep_alive);
+int format_headers(char *header, size_t size, const char *status, const char *content_type, long long content_length, int keep_alive, const char *extra_headers);
+int send_headers(int sock, const char *status, const char *content_type, long long content_length, int keep_alive, const char *extra_headers);
+int send_with_body(int sock, const char *header, size_t header_length, int fd, const char *body, off_t offset, size_t length);
+void set_cork(int sock, int on);
+int send_file(int sock, int fd, off_t offset, size_t length);
+int stream_file_chunked(int sock, int fd);
+int write_all(int sock, const char *buf, size_t len);
+int sendv_all(int sock, struct iovec *iov, int iovcnt, int flags);
+int send_cached(int sock, CacheEntry *entry, const char *content_type, const char *extra_headers, int keep_alive, int is_head);
+void http_date(char *buf, size_t size);
+void format_http_date(char *buf, size_t size, time_t when);
+int parse_http_date(Str value, time_t *when);
+void format_etag(char *buf, size_t size, const struct stat *st);
+void format_validators(char *buf, size_t size, const char *etag, time_t mtime);
+int is_not_modified(Request *request, const char *etag, time_t mtime);
+int send_not_modified(int sock, const char *etag, time_t mtime, const char *extra_headers, int keep_alive);
+int parse_offset(const char **p, const char *end, off_t *value);
+int requested_ranges(Request *request, const char *etag, time_t mtime, off_t size, ByteRange *ranges);
+int send_ranges(int sock, ByteRange *ranges, int count, off_t size, const char *content_type, const char *extra_headers, int fd, const char *body, int keep_alive);
+int send_entry(int sock, Request *request, CacheEntry *entry, const char *content_type, const char *extra_headers, int keep_alive, int is_head);
+long long parse_size(const char *arg);
+void handle_cgi_request(Connection *conn, const char *cgi_script_path, Request *request, WorkerArgs *args);
+int is_python_script(const char *script);
+void handle_fastcgi_request(int sock, const char *cgi_script_path, Request *request, const char *client_ip, int server_port, FcgiPool *pool, WorkQueue *queue);
+const char* split_script_path(const char *cgi_script_path, char *script, size_t size);
+void init_cgi_name_map(void);
+void add_cgi_var(CgiEnv *env, const char *name, size_t name_length, const char *value, size_t value_length);
+void build_cgi_env(CgiEnv *env, Request *request, const char *script, const char *query, const char *client_ip, int server_port);
+void relay_cgi_output(int sock, int fd, FcgiRequest *fcgi, Request *request, WorkQueue *queue);
+ssize_t read_cgi_output(int fd, FcgiRequest *fcgi, char *buf, size_t size);
+int splice_to_socket(int sock, int pipe_fd);
+size_t add_status_line(char *head, size_t head_length, size_t size);
+int cgi_may_gzip(Request *request);
+int prepare_cgi_head(char *head, size_t *head_length, size_t *body_offset, int may_gzip, WorkQueue *queue, z_stream *stream);
+const char* raw_header(const char *head, const char *end, const char *name);
+int send_gzip(int sock, z_stream *stream, const char *data, size_t length, int flush);
+
+int main(int argc, char *argv[]) {
+    int port = DEFAULT_PORT;
+    char *wwwroot = NULL;
+    int numThreads = DEFAULT_NUM_THREADS;
+    int timeout = DEFAULT_TIMEOUT_DURATION; 
+    char *cgi_script_path = NULL;
+    int keepAliveTimeout = DEFAULT_KEEP_ALIVE_TIMEOUT;
+    int maxRequests = DEFAULT_MAX_REQUESTS;
+    int parser = PARSER_YACC;
+    int queueSize = DEFAULT_QUEUE_CAPACITY;
+    int numListeners = 1;
+    int backlog = DEFAULT_BACKLOG;
+    int engine = ENGINE_EPOLL;
+    long long cacheSize = DEFAULT_CACHE_SIZE;
+    int fdCacheSize = DEFAULT_FD_CACHE_SIZE;
+    char *fastcgi = NULL;
+    int fastcgiProcesses = DEFAULT_FASTCGI_PROCESSES;
+    char *zygote = NULL;
+
+    struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"root", required_argument, 0, 'r'},
+        {"numThreads", required_argument, 0, 'n'},
+        {"timeout", required_argument, 0, 't'},
+        {"cgiHandler", required_argument, 0, 'c'},
+        {"keepAliveTimeout", required_argument, 0, 'k'},
+        {"maxRequests", required_argument, 0, 'm'},
+        {"parser", required_argument, 0, 'P'},
+        {"queueSize", required_argument, 0, 'q'},
+        {"listeners", required_argument, 0, 'l'},
+        {"backlog", required_argument, 0, 'b'},
+        {"engine", required_argument, 0, 'e'},
+        {"cacheSize", required_argument, 0, 'C'},
+        {"fdCacheSize", required_argument, 0, 'F'},
+        {"compress", required_argument, 0, 'z'},
+        {"fastcgi", required_argument, 0, 'f'},
+        {"fastcgiProcesses", required_argument, 0, 'N'},
+        {"zygote", required_argument, 0, 'Z'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:r:n:t:c:k:m:P:q:l:b:e:C:F:z:f:N:Z:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'r':
+                wwwroot = strdup(optarg);
+                break;
+            case 'n':
+                numThreads = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg) * 1000; 
+                break;
+            case 'c':
+                cgi_script_path = strdup(optarg);
+                break;
+            case 'k':
+                keepAliveTimeout = atoi(optarg) * 1000;
+                break;
+            case 'm':
+                maxRequests = atoi(optarg);
+                break;
+            case 'P':
+                if (strcmp(optarg, "yacc") == 0) {
+                    parser = PARSER_YACC;
+                } else if (strcmp(optarg, "fsm") == 0) {
+                    parser = PARSER_FSM;
+                } else {
+                    fprintf(stderr, "Unknown parser '%s' (expected yacc or fsm)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'q':
+                queueSize = atoi(optarg);
+                if (queueSize < 1) {
+                    fprintf(stderr, "Queue size must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                numListeners = atoi(optarg);
+                if (numListeners < 1) {
+                    fprintf(stderr, "Need at least one listener\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                backlog = atoi(optarg);
+                if (backlog < 1) {
+                    fprintf(stderr, "Backlog must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "epoll") == 0) {
+                    engine = ENGINE_EPOLL;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    engine = ENGINE_URING;
+                } else {
+                    fprintf(stderr, "Unknown engine '%s' (expected epoll or uring)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                cacheSize = parse_size(optarg);
+                if (cacheSize < 0) {
+                    fprintf(stderr, "Invalid cache size '%s' (bytes, optionally with K, M or G)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'F':
+                fdCacheSize = atoi(optarg);
+                if (fdCacheSize < 0) {
+                    fprintf(stderr, "fd cache size cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'z':
+                if (compress_configure(optarg) < 0) {
+                    fprintf(stderr, "Invalid compression setting '%s' (expected type=level,... with levels 0-9)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'f':
+                fastcgi = optarg;
+                break;
+            case 'N':
+                fastcgiProcesses = atoi(optarg);
+                if (fastcgiProcesses < 1 || fastcgiProcesses > FCGI_MAX_PROCESSES) {
+                    fprintf(stderr, "FastCGI processes must be between 1 and %d\n", FCGI_MAX_PROCESSES);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'Z':
+                zygote = optarg;
+                break;
+            default:
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!wwwroot) {
+        fprintf(stderr, "wwwroot directory is required\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cgi_script_path == NULL) {
+        fprintf(stderr, "CGI handler script path is required\n");
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+    init_cgi_name_map();
+
+    // One cache for the whole process; its shards keep workers apart.
+    FileCache *cache = NULL;
+    if (cacheSize > 0) {
+        cache = malloc(sizeof(FileCache));
+        if (!cache) {
+            perror("Failed to allocate memory for the file cache");
+            exit(EXIT_FAILURE);
+        }
+        init_file_cache(cache, cacheSize);
+    }
+
+    FdCache *fdCache = NULL;
+    if (fdCacheSize > 0) {
+        fdCache = malloc(sizeof(FdCache));
+        if (!fdCache) {
+            perror("Failed to allocate memory for the fd cache");
+            exit(EXIT_FAILURE);
+        }
+        init_fd_cache(fdCache, fdCacheSize);
+    }
+
+    // /cgi/ requests go to long-lived FastCGI processes instead of a fork
+    // per request. They are started before any thread exists.
+    FcgiPool *fcgiPool = NULL;
+    if (fastcgi) {
+        fcgiPool = malloc(sizeof(FcgiPool));
+        if (!fcgiPool || fcgi_pool_init(fcgiPool, fastcgi, fastcgiProcesses) < 0) {
+            perror("Failed to set up the FastCGI application");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Python scripts are forked from a pre-loaded interpreter instead.
+    Zygote *pythonZygote = NULL;
+    if (zygote) {
+        pythonZygote = malloc(sizeof(Zygote));
+        if (!pythonZygote || zygote_start(pythonZygote, zygote) < 0) {
+            perror("Failed to start the zygote");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (cache || fdCache) {
+        RootWatch *watch = malloc(sizeof(RootWatch));
+        if (!watch || start_root_watch(watch, wwwroot, cache, fdCache) < 0) {
+            fprintf(stderr, "Cannot watch %s (%s), cached files are revalidated with stat()\n", wwwroot, strerror(errno));
+            free(watch);
+        }
+    }
+
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCores < 1) {
+        numCores = 1;
+    }
+
+    // Running scripts are fed and relayed by loops of their own, one per
+    // core, so a slow script holds no worker. FastCGI needs none.
+    CgiLoop *cgiLoops = NULL;
+    if (!fcgiPool) {
+        cgiLoops = malloc(sizeof(CgiLoop) * numCores);
+        if (!cgiLoops) {
+            perror("Failed to allocate memory for CGI loops");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < numCores; ++i) {
+            init_cgi_loop(&cgiLoops[i], timeout);
+        }
+    }
+
+    Listener *listeners = malloc(sizeof(Listener) * numListeners);
+    if (!listeners) {
+        perror("Failed to allocate memory for listeners");
+        exit(EXIT_FAILURE);
+    }
+
+    // Workers and event loops are split evenly across the listeners; each
+    // listener gets its own queue of queueSize.
+    for (int l = 0; l < numListeners; ++l) {
+        Listener *listener = &listeners[l];
+        int workers = numThreads / numListeners + (l < numThreads % numListeners);
+        if (workers < 1) {
+            workers = 1;
+        }
+
+        listener->port = port;
+        listener->sockfd = open_listener(port, backlog, numListeners > 1);
+
+        listener->pool = malloc(sizeof(ThreadPool));
+        if (!listener->pool) {
+            perror("Failed to allocate memory for ThreadPool");
+            exit(EXIT_FAILURE);
+        }
+
+        // The ring's hot counters sit on their own cache lines.
+        listener->pool->work_queue = aligned_alloc(64, sizeof(WorkQueue));
+        if (!listener->pool->work_queue) {
+            perror("Failed to allocate memory for WorkQueue");
+            exit(EXIT_FAILURE);
+        }
+
+        init_work_queue(listener->pool->work_queue, queueSize);
+        init_thread_pool(listener->pool, workers, listener->pool->work_queue, wwwroot, timeout, cgi_script_path, keepAliveTimeout, maxRequests, parser, cache, fdCache, fcgiPool, pythonZygote, cgiLoops, numCores);
+
+        listener->uring = NULL;
+        if (engine == ENGINE_URING) {
+            listener->uring = malloc(sizeof(UringLoop));
+            listener->loops = malloc(sizeof(EventLoop));
+            if (!listener->uring || !listener->loops) {
+                perror("Failed to allocate memory for io_uring loop");
+                exit(EXIT_FAILURE);
+            }
+            if (init_uring_loop(listener->uring, listener->loops, listener->pool->work_queue, timeout, listener->sockfd, port) == 0) {
+                listener->num_loops = 1;
+                start_uring_loop(listener->uring);
+                continue;
+            }
+            fprintf(stderr, "io_uring engine unavailable (%s), falling back to epoll\n", strerror(errno));
+            free(listener->uring);
+            free(listener->loops);
+            listener->uring = NULL;
+            engine = ENGINE_EPOLL;
+        }
+
+        listener->num_loops = numCores / numListeners;
+        if (listener->num_loops < 1) {
+            listener->num_loops = 1;
+        }
+        listener->loops = malloc(sizeof(EventLoop) * listener->num_loops);
+        if (!listener->loops) {
+            perror("Failed to allocate memory for event loops");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < listener->num_loops; ++i) {
+            init_event_loop(&listener->loops[i], listener->pool->work_queue, timeout);
+        }
+    }
+
+    printf("Server is listening on port %d (%d listener%s)...\n", port, numListeners, numListeners > 1 ? "s" : "");
+
+    // The main thread runs the first accept loop itself. Listeners on
+    // io_uring accept from their ring thread instead.
+    for (int l = 1; l < numListeners; ++l) {
+        if (!listeners[l].uring) {
+            pthread_create(&listeners[l].acceptor, NULL, accept_connections, &listeners[l]);
+        }
+    }
+    if (listeners[0].uring) {
+        pthread_join(listeners[0].uring->thread, NULL);
+    } else {
+        accept_connections(&listeners[0]);
+    }
+
+    free(wwwroot);
+    for (int l = 0; l < numListeners; ++l) {
+        ThreadPool *threadPool = listeners[l].pool;
+        for (int i = 0; i < threadPool->thread_count; ++i) {
+            pthread_join(threadPool->threads[i], NULL);
+        }
+        free_work_queue(threadPool->work_queue);
+        free(threadPool->work_queue);
+        free(threadPool);
+        free(listeners[l].loops);
+        free(listeners[l].uring);
+    }
+    free(listeners);
+
+    if (cgi_script_path) {
+        free(cgi_script_path);
+    }
+
+    return 0;
+}
+
+
+void* worker_thread(void* arg) {
+    WorkerArgs *workerArgs = (WorkerArgs *)arg;
+    WorkQueue *queue = workerArgs->workQueue;
+    char *wwwRoot = workerArgs->wwwRoot;
+    char *cgi_script_path = workerArgs->cgi_script_path;
+
+    while (1) {
+        WorkItem item = dequeue_work(queue);
+
+        Connection *conn = item.conn;
+        if (handle_connection(conn, workerArgs)) {
+            event_loop_rearm(conn->loop, conn);
+        } else if (conn->cgi) {
+            // Only now, with the worker done touching conn, can the CGI
+            // loop take it over.
+            cgi_loop_add(conn->cgi);
+        } else {
+            close_connection(conn);
+        }
+    }
+
+    free(wwwRoot);
+    if (cgi_script_path) {
+        free(cgi_script_path);
+    }
+    free(workerArgs);
+
+    return NULL;
+}
+
+
+void init_thread_pool(ThreadPool* pool, int num_threads, WorkQueue* queue, char *wwwRoot, int timeout, char *cgi_script_path, int keep_alive_timeout, int max_requests, int parser, FileCache *cache, FdCache *fd_cache, FcgiPool *fastcgi, Zygote *zygote, CgiLoop *cgi_loops, int num_cgi_loops) {
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    pool->thread_count = num_threads;
+    pool->work_queue = queue;
+    queue->workers = num_threads;
+
+    for (int i = 0; i < num_threads; ++i) {
+        WorkerArgs *workerArgs = malloc(sizeof(WorkerArgs));
+        workerArgs->workQueue = queue;
+        workerArgs->wwwRoot = strdup(wwwRoot);
+        workerArgs->timeout = timeout;
+        workerArgs->cgi_script_path = cgi_script_path ? strdup(cgi_script_path) : NULL;
+        workerArgs->keep_alive_timeout = keep_alive_timeout;
+        workerArgs->max_requests = max_requests;
+        workerArgs->parser = parser;
+        workerArgs->cache = cache;
+        workerArgs->fd_cache = fd_cache;
+        workerArgs->fastcgi = fastcgi;
+        workerArgs->zygote = zygote;
+        workerArgs->cgi_loops = cgi_loops;
+        workerArgs->num_cgi_loops = num_cgi_loops;
+
+        pthread_create(&pool->threads[i], NULL, worker_thread, workerArgs);
+    }
+}
+
+
+
+void signal_handler(int signum) {
+    printf("\nReceived signal %d. Shutting down...\n", signum);
+    printf("Connections shed under overload: %lu\n", shed_connections());
+    exit(signum);
+}
+
+/**
+ * Opens a listening socket on port. With reuse_port several sockets can
+ * bind the same port and the kernel spreads incoming connections over them.
+ */
+int open_listener(int port, int backlog, int reuse_port) {
+    int sockfd;
+    int on = 1;
+    struct sockaddr_in server_addr;
+
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("ERROR opening socket");
+        exit(EXIT_FAILURE);
+    }
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_REUSEADDR)");
+    }
+    if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("ERROR on binding");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(sockfd, backlog) < 0) {
+        perror("ERROR on listen");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    return sockfd;
+}
+
+void* accept_connections(void *arg) {
+    Listener *listener = (Listener *)arg;
+    WorkQueue *queue = listener->pool->work_queue;
+    struct sockaddr_in client_addr;
+    socklen_t clilen;
+    int newsockfd;
+
+    int next_loop = 0;
+    while (1) {
+        clilen = sizeof(client_addr);
+        newsockfd = accept4(listener->sockfd, (struct sockaddr *)&client_addr, &clilen, SOCK_CLOEXEC);
+        if (newsockfd < 0) {
+            perror("ERROR on accept");
+            continue;
+        }
+
+        Connection *conn = new_connection(newsockfd, &client_addr, listener->port);
+        if (!conn) {
+            close(newsockfd);
+            continue;
+        }
+
+        // Nothing would pick this connection up any time soon; say so now
+        // rather than letting the client wait out its own timeout.
+        if (work_queue_full(queue)) {
+            shed_connection(conn);
+            continue;
+        }
+
+        event_loop_add(&listener->loops[next_loop], conn);
+        next_loop = (next_loop + 1) % listener->num_loops;
+    }
+
+    close(listener->sockfd);
+    return NULL;
+}
+
+/**
+ * Drains whatever the socket has for us without blocking and serves every
+ * complete request in the buffer. Returns 1 if the connection should go back
+ * to its event loop to wait for more input, 0 if it should be closed.
+ */
+int handle_connection(Connection *conn, WorkerArgs *args) {
+    int sock = conn->fd;
+    int nbytes;
+    int was_empty = conn->buf_len == 0;
+
+    // Under io_uring the bytes are already in buf and the idle timer has
+    // been dealt with; another read would only come back empty.
+    while (!conn->prefetched && conn->buf_len < BUFFER_SIZE - 1) {
+        nbytes = recv(sock, conn->buf + conn->buf_len, BUFFER_SIZE - 1 - conn->buf_len, MSG_DONTWAIT);
+        if (nbytes > 0) {
+            conn->buf_len += nbytes;
+            continue;
+        }
+        if (nbytes == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        perror("ERROR reading from socket");
+        return 0;
+    }
+
+    conn->prefetched = 0;
+
+    // The keep-alive idle timer stops once a new request starts arriving;
+    // from here on the client gets the regular request timeout.
+    if (was_empty && conn->buf_len > 0 && conn->requests_served > 0) {
+        conn->deadline = now_ms() + args->timeout;
+    }
+
+    while (1) {
+        conn->buf[conn->buf_len] = '\0';
+
+        int header_length;
+        int parsed = -1;
+        Request req;
+        Request *request = &req;
+        if (args->parser == PARSER_FSM) {
+            // Resumes from wherever the previous read left the head.
+            int rc = http_parser_execute(&conn->parser, conn->buf, conn->buf_len);
+            if (rc == HTTP_PARSE_AGAIN && conn->buf_len < BUFFER_SIZE - 1) {
+                return 1;
+            }
+            header_length = conn->parser.pos;
+            if (rc == HTTP_PARSE_DONE) {
+                parsed = request_from_parser(&conn->parser, conn->buf, request);
+            }
+        } else {
+            header_length = find_header_end(conn->buf, conn->buf_len, &conn->head_scanned);
+            if (header_length < 0) {
+                if (conn->buf_len < BUFFER_SIZE - 1) {
+                    return 1;
+                }
+                send_error(sock, "400 Bad Request", 0);
+                return 0;
+            }
+            parsed = parse(conn->buf, header_length, sock, request);
+        }
+        if (parsed != SUCCESS) {
+            send_error(sock, "400 Bad Request", 0);
+            return 0;
+        }
+
+        const Str *content_length = get_header(request, "Content-Length");
+        long body_length = content_length ? str_to_long(*content_length) : 0;
+        if (body_length < 0) {
+            send_error(sock, "400 Bad Request", 0);
+            free_request(request);
+            return 0;
+        }
+        if (header_length + body_length > BUFFER_SIZE - 1) {
+            send_error(sock, "413 Payload Too Large", 0);
+            free_request(request);
+            return 0;
+        }
+        if (header_length + body_length > conn->buf_len) {
+            free_request(request);
+            return 1;
+        }
+        request->body = conn->buf + header_length;
+        request->body_length = body_length;
+
+        int keep_alive = wants_keep_alive(request) && conn->requests_served + 1 < args->max_requests;
+        keep_alive = handle_request(conn, request, keep_alive, args);
+        free_request(request);
+        conn->requests_served++;
+
+        int consumed = header_length + body_length;
+        conn->buf_len -= consumed;
+        memmove(conn->buf, conn->buf + consumed, conn->buf_len);
+        http_parser_init(&conn->parser);
+        conn->head_scanned = 0;
+
+        if (!keep_alive) {
+            return 0;
+        }
+        conn->deadline = now_ms() + (conn->buf_len > 0 ? args->timeout : args->keep_alive_timeout);
+    }
+}
+
+/**
+ * HTTP/1.1 connections are persistent unless the client says otherwise.
+ */
+int wants_keep_alive(Request *request) {
+    if (!str_eq(request->http_version, "HTTP/1.1")) {
+        return 0;
+    }
+
+    const Str *connection = get_header(request, "Connection");
+    return !connection || !str_caseeq(*connection, "close");
+}
+
+/**
+ * Serves a single parsed request. Returns whether the connection can carry
+ * another request afterwards.
+ */
+int handle_request(Connection *conn, Request *request, int keep_alive, WorkerArgs *args) {
+    int sock = conn->fd;
+
+    if (!str_eq(request->http_method, "GET") && !str_eq(request->http_method, "HEAD") && !str_eq(request->http_method, "POST")) {
+        send_error(sock, "501 Not Implemented", keep_alive);
+        return keep_alive;
+    }
+
+    if (!str_eq(request->http_version, "HTTP/1.1")) {
+        send_error(sock, "505 HTTP Version Not Supported", 0);
+        return 0;
+    }
+
+    Str uri = request->http_uri;
+    if (uri.len >= 5 && strncmp(uri.data, "/cgi/", 5) == 0) {
+        char cgi_script_path[4096];
+        snprintf(cgi_script_path, sizeof(cgi_script_path), "%s%.*s", args->cgi_script_path, (int)uri.len - 5, uri.data + 5);
+        printf("CGI script path: %s\n", cgi_script_path);
+        // The script writes its own headers, so the end of its output can
+        // only be signalled by closing the connection.
+        if (args->fastcgi) {
+            handle_fastcgi_request(sock, cgi_script_path, request, connection_peer(conn), conn->server_port, args->fastcgi, args->workQueue);
+        } else {
+            handle_cgi_request(conn, cgi_script_path, request, args);
+        }
+        return 0;
+    } 
+    
+    else {
+        char filepath[8192];
+        snprintf(filepath, sizeof(filepath), "%s%.*s", args->wwwRoot, (int)uri.len, uri.data);
+        return serve_static(sock, request, filepath, get_content_type(filepath), NULL, keep_alive, args);
+    }
+}
+
+/**
+ * Serves the file at filepath. encoding is set when filepath is a
+ * precompressed sidecar chosen by serve_variant(); the response then
+ * carries Content-Encoding and -1 is returned if the sidecar has gone,
+ * so the caller can fall back to the original. Otherwise returns whether
+ * the connection can carry another request.
+ */
+int serve_static(int sock, Request *request, const char *filepath, const char *content_type, const Encoding *encoding, int keep_alive, WorkerArgs *args) {
+    // HEAD gets the same headers as GET but must not get a body,
+    // or the client would read it as the next response.
+    int is_head = str_eq(request->http_method, "HEAD");
+
+    // Conditional requests are answered from the file's metadata alone.
+    int conditional = !str_eq(request->http_method, "POST") &&
+                      (get_header(request, "If-None-Match") || get_header(request, "If-Modified-Since"));
+    const Str *accept_encoding = encoding ? NULL : get_header(request, "Accept-Encoding");
+    char etag[64];
+    char validators[160];
+    char coding[96] = "";
+    char headers[320];
+
+    if (encoding) {
+        snprintf(coding, sizeof(coding), "Content-Encoding: %s\r\nVary: Accept-Encoding\r\n", encoding->token);
+    } else if (compress_level_for(content_type) > 0) {
+        // Clients that do not take gzip may get a different body.
+        strcpy(coding, "Vary: Accept-Encoding\r\n");
+    }
+
+    CacheEntry *entry = args->cache ? file_cache_get(args->cache, filepath, CODING_IDENTITY) : NULL;
+    if (entry) {
+        int sent;
+        int result = -1;
+        if (entry->encodings) {
+            int chosen = choose_encoding(accept_encoding, entry->encodings);
+            result = chosen >= 0 ? serve_variant(sock, request, filepath, content_type, chosen, keep_alive, args) : -1;
+            strcpy(coding, "Vary: Accept-Encoding\r\n");
+        } else if (!encoding) {
+            result = serve_gzip(sock, request, entry, content_type, conditional, keep_alive, args);
+        }
+        if (result >= 0) {
+            file_cache_release(entry);
+            return result;
+        }
+        if (conditional && is_not_modified(request, entry->etag, entry->mtime.tv_sec)) {
+            sent = send_not_modified(sock, entry->etag, entry->mtime.tv_sec, coding, keep_alive);
+        } else {
+            sent = send_entry(sock, request, entry, content_type, coding, keep_alive, is_head);
+        }
+        if (sent < 0) {
+            keep_alive = 0;
+        }
+        file_cache_release(entry);
+        return keep_alive;
+    }
+
+    unsigned cache_gen = args->cache ? file_cache_generation(args->cache) : 0;
+    unsigned fd_cache_gen = args->fd_cache ? fd_cache_generation(args->fd_cache) : 0;
+
+    // Large files are served from a descriptor kept open across requests.
+    // Anything else is looked at with stat() first, which also tells
+    // whether it is worth looking for sidecars.
+    OpenFile *file = args->fd_cache ? fd_cache_get(args->fd_cache, filepath) : NULL;
+    struct stat st;
+    int found = file ? (st = file->st, 1) : stat(filepath, &st) == 0;
+    int available = 0;
+    if (file) {
+        available = file->encodings;
+    } else if (found && S_ISREG(st.st_mode) && !encoding) {
+        available = probe_sidecars(filepath);
+    }
+
+    if (available) {
+        int chosen = choose_encoding(accept_encoding, available);
+        int result = chosen >= 0 ? serve_variant(sock, request, filepath, content_type, chosen, keep_alive, args) : -1;
+        if (result >= 0) {
+            if (file) {
+                fd_cache_release(file);
+            }
+            return result;
+        }
+        strcpy(coding, "Vary: Accept-Encoding\r\n");
+    }
+
+    if (conditional && found && S_ISREG(st.st_mode)) {
+        format_etag(etag, sizeof(etag), &st);
+        if (is_not_modified(request, etag, st.st_mtim.tv_sec)) {
+            if (send_not_modified(sock, etag, st.st_mtim.tv_sec, coding, keep_alive) < 0) {
+                keep_alive = 0;
+            }
+            if (file) {
+                fd_cache_release(file);
+            }
+            return keep_alive;
+        }
+    }
+
+    // HEAD is answered from the metadata; the file is never opened or read.
+    if (is_head && found && !S_ISDIR(st.st_mode) && (file || access(filepath, R_OK) == 0)) {
+        if (send_head(sock, request, filepath, &st, content_type, coding, !encoding && !available, keep_alive, args) < 0) {
+            keep_alive = 0;
+        }
+        if (file) {
+            fd_cache_release(file);
+        }
+        return keep_alive;
+    }
+
+    int fd = file ? file->fd : (found ? open(filepath, O_RDONLY | O_CLOEXEC) : -1);
+    if (file) {
+        st = file->st;
+    }
+    if (fd < 0 || (!file && fstat(fd, &st) < 0) || S_ISDIR(st.st_mode) || (encoding && !S_ISREG(st.st_mode))) {
+        if (encoding) {
+            keep_alive = -1;
+        } else {
+            send_error(sock, "404 Not Found", keep_alive);
+        }
+    } 
+    
+    else {
+        int sent;
+
+        if (S_ISREG(st.st_mode)) {
+            format_etag(etag, sizeof(etag), &st);
+            format_validators(validators, sizeof(validators), etag, st.st_mtim.tv_sec);
+        }
+
+        if (S_ISREG(st.st_mode) && args->cache &&
+            (entry = file_cache_fill(args->cache, filepath, fd, &st, validators, etag, available, cache_gen))) {
+            int result = available || encoding ? -1 : serve_gzip(sock, request, entry, content_type, conditional, keep_alive, args);
+            if (result >= 0) {
+                keep_alive = result;
+                sent = 0;
+            } else {
+                sent = send_entry(sock, request, entry, content_type, coding, keep_alive, is_head);
+            }
+            file_cache_release(entry);
+        } else if (S_ISREG(st.st_mode)) {
+            if (!file && args->fd_cache) {
+                file = fd_cache_put(args->fd_cache, filepath, fd, &st, available, fd_cache_gen);
+            }
+            snprintf(headers, sizeof(headers), "%s%s", coding, validators);
+            ByteRange ranges[MAX_RANGES];
+            int range_count = requested_ranges(request, etag, st.st_mtim.tv_sec, st.st_size, ranges);
+            if (range_count >= 0) {
+                sent = send_ranges(sock, ranges, range_count, st.st_size, content_type, headers, fd, NULL, keep_alive);
+            } else {
+                char header[2048];
+                snprintf(headers, sizeof(headers), "Accept-Ranges: bytes\r\n%s%s", coding, validators);
+                int header_length = format_headers(header, sizeof(header), "200 OK", content_type, st.st_size, keep_alive, headers);
+                sent = send_with_body(sock, header, header_length, fd, NULL, 0, is_head ? 0 : st.st_size);
+            }
+        } else {
+            // Pipes and devices have no size up front, so stream them.
+            // The cork keeps chunk framing and data in full segments.
+            set_cork(sock, 1);
+            sent = send_headers(sock, "200 OK", content_type, -1, keep_alive, NULL);
+            if (sent == 0 && !is_head) {
+                sent = stream_file_chunked(sock, fd);
+            }
+            set_cork(sock, 0);
+        }
+
+        if (sent < 0) {
+            keep_alive = 0;
+        }
+    }
+
+    if (file) {
+        fd_cache_release(file);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    return keep_alive;
+}
+
+/**
+ * Sends a gzip copy of the cached file source if its type is compressed
+ * and the client takes gzip. The copy is made at most once per version of
+ * the file and cached next to it, at a level that drops as the workers get
+ * busy. A file gzip does not shrink gets an empty copy instead, so it is
+ * not compressed again for nothing. Returns -1 if the caller should send
+ * the file as is.
+ */
+int serve_gzip(int sock, Request *request, CacheEntry *source, const char *content_type, int conditional, int keep_alive, WorkerArgs *args) {
+    if (!wants_gzip(request, content_type, source->body_length)) {
+        return -1;
+    }
+
+    // A different body needs a different strong ETag.
+    char etag[80];
+    char validators[176];
+    int sent;
+    format_gzip_etag(etag, sizeof(etag), source->etag);
+    format_validators(validators, sizeof(validators), etag, source->mtime.tv_sec);
+
+    CacheEntry *entry = file_cache_get(args->cache, source->path, ENCODING_GZIP);
+    if (entry && (entry->ino != source->ino || entry->size != source->size ||
+                  entry->mtime.tv_sec != source->mtime.tv_sec || entry->mtime.tv_nsec != source->mtime.tv_nsec)) {
+        file_cache_release(entry);
+        entry = NULL;
+    }
+    if (entry && entry->body_length == 0) {
+        file_cache_release(entry);
+        return -1;
+    }
+    if (!entry && str_eq(request->http_method, "HEAD")) {
+        // Not worth compressing just to learn the length HEAD would show.
+        char headers[320];
+        snprintf(headers, sizeof(headers), "Accept-Ranges: bytes\r\n" GZIP_CODING "%s", validators);
+        if (conditional && is_not_modified(request, etag, source->mtime.tv_sec)) {
+            sent = send_not_modified(sock, etag, source->mtime.tv_sec, GZIP_CODING, keep_alive);
+        } else {
+            sent = send_headers(sock, "200 OK", content_type, CONTENT_LENGTH_UNKNOWN, keep_alive, headers);
+        }
+        return sent < 0 ? 0 : keep_alive;
+    }
+    if (!entry) {
+        int level = compress_level(compress_level_for(content_type), args->workQueue);
+        size_t length;
+        char *compressed = level > 0 ? gzip_buffer(source->body, source->body_length, level, &length) : NULL;
+        if (!compressed) {
+            return -1;
+        }
+        if (length >= source->body_length) {
+            free(compressed);
+            entry = file_cache_store(args->cache, source, ENCODING_GZIP, validators, etag, "", 0);
+            if (entry) {
+                file_cache_release(entry);
+            }
+            return -1;
+        }
+
+        entry = file_cache_store(args->cache, source, ENCODING_GZIP, validators, etag, compressed, length);
+        free(compressed);
+        if (!entry) {
+            return -1;
+        }
+    }
+
+    if (conditional && is_not_modified(request, entry->etag, entry->mtime.tv_sec)) {
+        sent = send_not_modified(sock, entry->etag, entry->mtime.tv_sec, GZIP_CODING, keep_alive);
+    } else {
+        sent = send_entry(sock, request, entry, content_type, GZIP_CODING, keep_alive, str_eq(request->http_method, "HEAD"));
+    }
+    file_cache_release(entry);
+    return sent < 0 ? 0 : keep_alive;
+}
+
+// Whether a size-byte body of content_type goes out gzipped to this client.
+int wants_gzip(Request *request, const char *content_type, off_t size) {
+    return size >= COMPRESS_MIN_SIZE && compress_level_for(content_type) > 0 &&
+           choose_encoding(get_header(request, "Accept-Encoding"), 1 << ENCODING_GZIP) >= 0;
+}
+
+// The ETag of a gzip copy: the original's with ".gz" added inside the quotes.
+void format_gzip_etag(char *buf, size_t size, const char *etag) {
+    snprintf(buf, size, "%.*s.gz\"", (int)strlen(etag) - 1, etag);
+}
+
+/**
+ * Answers HEAD from the file's metadata alone, with the headers GET would
+ * send. may_compress says GET could gzip the file on the fly; unless a
+ * gzip copy is already cached its length is then unknown without reading
+ * the file, so it is left out as RFC 9110 (9.3.2) allows.
+ */
+int send_head(int sock, Request *request, const char *filepath, const struct stat *st, const char *content_type, const char *coding, int may_compress, int keep_alive, WorkerArgs *args) {
+    char etag[80];
+    char validators[176];
+    char headers[320];
+
+    if (!S_ISREG(st->st_mode)) {
+        return send_headers(sock, "200 OK", content_type, -1, keep_alive, NULL);
+    }
+
+    format_etag(etag, sizeof(etag), st);
+    if (may_compress && args->cache && (size_t)st->st_size <= args->cache->max_entry &&
+        wants_gzip(request, content_type, st->st_size)) {
+        CacheEntry *entry = file_cache_get(args->cache, filepath, ENCODING_GZIP);
+        if (entry && (entry->ino != st->st_ino || entry->size != st->st_size ||
+                      entry->mtime.tv_sec != st->st_mtim.tv_sec || entry->mtime.tv_nsec != st->st_mtim.tv_nsec)) {
+            file_cache_release(entry);
+            entry = NULL;
+        }
+        if (entry && entry->body_length > 0) {
+            int sent = send_cached(sock, entry, content_type, GZIP_CODING, keep_alive, 1);
+            file_cache_release(entry);
+            return sent;
+        }
+        if (!entry) {
+            char gzip_etag[80];
+            format_gzip_etag(gzip_etag, sizeof(gzip_etag), etag);
+            format_validators(validators, sizeof(validators), gzip_etag, st->st_mtim.tv_sec);
+            snprintf(headers, sizeof(headers), "Accept-Ranges: bytes\r\n" GZIP_CODING "%s", validators);
+            return send_headers(sock, "200 OK", content_type, CONTENT_LENGTH_UNKNOWN, keep_alive, headers);
+        }
+        // An empty copy: gzip does not shrink the file, so GET sends it as is.
+        file_cache_release(entry);
+    }
+
+    format_validators(validators, sizeof(validators), etag, st->st_mtim.tv_sec);
+    snprintf(headers, sizeof(headers), "Accept-Ranges: bytes\r\n%s%s", coding, validators);
+    return send_headers(sock, "200 OK", content_type, st->st_size, keep_alive, headers);
+}
+
+/**
+ * Serves the sidecar of filepath for encodings[chosen] in its place,
+ * under the original's Content-Type. Returns -1 if there is no such
+ * sidecar after all.
+ */
+int serve_variant(int sock, Request *request, const char *filepath, const char *content_type, int chosen, int keep_alive, WorkerArgs *args) {
+    char variant[8192];
+    if (snprintf(variant, sizeof(variant), "%s%s", filepath, encodings[chosen].suffix) >= (int)sizeof(variant)) {
+        return -1;
+    }
+    return serve_static(sock, request, variant, content_type, &encodings[chosen], keep_alive, args);
+}
+
+/**
+ * Starts the script with posix_spawn(), which does not copy the server's
+ * page tables the way fork() does, so starting one costs the same however
+ * big the server has grown. Everything the script gets is prepared up
+ * front: its environment in env, and its stdin and stdout as pipes.
+ * Python scripts are handed to the zygote when there is one; it forks
+ * them from an interpreter that is already loaded.
+ */
+void handle_cgi_request(Connection *conn, const char *cgi_script_path, Request *request, WorkerArgs *args) {
+    int sock = conn->fd;
+    Zygote *zygote = args->zygote;
+    char script[4096];
+    CgiEnv env;
+    const char *query = split_script_path(cgi_script_path, script, sizeof(script));
+    build_cgi_env(&env, request, script, query, connection_peer(conn), conn->server_port);
+
+    // The zygote runs the file whatever its mode, so answer as exec would.
+    if (zygote && is_python_script(script) && access(script, R_OK | X_OK) < 0) {
+        send_error(sock, errno == ENOENT ? "404 Not Found" : "500 Internal Server Error", 0);
+        return;
+    }
+
+    int c2pFds[2];
+    int p2cFds[2];
+    if (pipe2(c2pFds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        send_error(sock, "500 Internal Server Error", 0);
+        return;
+    }
+    if (pipe2(p2cFds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        send_error(sock, "500 Internal Server Error", 0);
+        close(c2pFds[0]);
+        close(c2pFds[1]);
+        return;
+    }
+    // Fewer, bigger splices for scripts with a lot to say. Best effort:
+    // the size is capped by fs.pipe-max-size.
+    fcntl(c2pFds[0], F_SETPIPE_SZ, CGI_PIPE_SIZE);
+
+    // A script from the zygote is its child, not ours: pid stays 0 and
+    // the zygote's pidfd is all there is to kill it or see it exit by.
+    pid_t pid = 0;
+    int pidfd = -1;
+    int error = -1;
+    if (zygote && is_python_script(script)) {
+        error = zygote_spawn(zygote, script, env.vars, p2cFds[0], c2pFds[1], &pidfd);
+        if (error) {
+            perror("zygote");
+        }
+    }
+    if (error) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, p2cFds[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, c2pFds[1], STDOUT_FILENO);
+        // No other descriptor of the server, client sockets included, leaks in.
+        posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+
+        const char *base_name = strrchr(script, '/');
+        char *argv[] = { (char *)(base_name ? base_name + 1 : script), NULL };
+        error = posix_spawn(&pid, script, &actions, NULL, argv, env.vars);
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    close(c2pFds[1]);
+    close(p2cFds[0]);
+
+    if (error) {
+        fprintf(stderr, "posix_spawn %s: %s\n", script, strerror(error));
+        send_error(sock, error == ENOENT ? "404 Not Found" : "500 Internal Server Error", 0);
+        close(c2pFds[0]);
+        close(p2cFds[1]);
+        return;
+    }
+
+    // From here on the CGI loop feeds the script and relays its output.
+    const char *body = str_eq(request->http_method, "POST") ? request->body : NULL;
+    size_t body_length = body ? request->body_length : 0;
+    conn->cgi = !args->cgi_loops ? NULL :
+                cgi_job_new(args->cgi_loops, args->num_cgi_loops, conn, p2cFds[1], c2pFds[0], pid, pidfd,
+                            body, body_length, cgi_may_gzip(request), args->workQueue);
+    if (conn->cgi) {
+        return;
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+
+    write_all(p2cFds[1], body, body_length);
+    close(p2cFds[1]);
+
+    relay_cgi_output(sock, c2pFds[0], NULL, request, args->workQueue);
+    close(c2pFds[0]);
+
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// Scripts the zygote can run: Python ones, by their extension.
+int is_python_script(const char *script) {
+    size_t length = strlen(script);
+    return length > 3 && strcmp(script + length - 3, ".py") == 0;
+}
+
+/**
+ * Runs the script on a process of the FastCGI pool. The application gets
+ * the variables a CGI script finds in its environment, and its response
+ * is relayed the same way.
+ */
+void handle_fastcgi_request(int sock, const char *cgi_script_path, Request *request, const char *client_ip, int server_port, FcgiPool *pool, WorkQueue *queue) {
+    char script[4096];
+    CgiEnv env;
+    const char *query = split_script_path(cgi_script_path, script, sizeof(script));
+    build_cgi_env(&env, request, script, query, client_ip, server_port);
+
+    const char *body = str_eq(request->http_method, "POST") ? request->body : NULL;
+    FcgiRequest fcgi;
+    if (fcgi_begin(pool, &fcgi, env.vars, body, body ? request->body_length : 0) < 0) {
+        send_error(sock, "502 Bad Gateway", 0);
+        return;
+    }
+    relay_cgi_output(sock, -1, &fcgi, request, queue);
+    fcgi_end(&fcgi);
+}
+
+/**
+ * Copies the script part of a CGI path ("/cgi/x.py?a=b") into script and
+ * returns the query string after the '?', or "" if there is none.
+ */
+const char* split_script_path(const char *cgi_script_path, char *script, size_t size) {
+    const char *query = strchr(cgi_script_path, '?');
+    int length = query ? (int)(query - cgi_script_path) : (int)strlen(cgi_script_path);
+    snprintf(script, size, "%.*s", length, cgi_script_path);
+    return query ? query + 1 : "";
+}
+
+// How each byte of a header name appears in its variable name, so that
+// User-Agent becomes HTTP_USER_AGENT; 0 for bytes that cannot appear.
+static unsigned char cgi_name_map[256];
+
+void init_cgi_name_map(void) {
+    for (int c = 0; c < 256; ++c) {
+        if (isalnum(c)) {
+            cgi_name_map[c] = toupper(c);
+        } else if (c == '-' || c == '_') {
+            cgi_name_map[c] = '_';
+        }
+    }
+}
+
+// Appends name=value to env, leaving it out if there is no room.
+void add_cgi_var(CgiEnv *env, const char *name, size_t name_length, const char *value, size_t value_length) {
+    size_t length = name_length + 1 + value_length + 1;
+    if (env->count == CGI_MAX_VARS || env->used + length > sizeof(env->strings)) {
+        return;
+    }
+    char *var = env->strings + env->used;
+    memcpy(var, name, name_length);
+    var[name_length] = '=';
+    memcpy(var + name_length + 1, value, value_length);
+    var[length - 1] = '\0';
+    env->used += length;
+    env->vars[env->count++] = var;
+    env->vars[env->count] = NULL;
+}
+
+/**
+ * Builds a script's environment (RFC 3875, 4.1) in env. Every request
+ * header becomes an HTTP_ variable in one pass over the headers, bar the
+ * ones with variables of their own, credentials, and Proxy, which scripts
+ * would take for their HTTP_PROXY setting. Of repeated headers the first
+ * one counts. PATH is passed on from the server so that "#!/usr/bin/env"
+ * lines work.
+ */
+void build_cgi_env(CgiEnv *env, Request *request, const char *script, const char *query, const char *client_ip, int server_port) {
+    static const char *const skipped[] = {
+        "Content-Length", "Content-Type", "Authorization", "Proxy-Authorization", "Proxy",
+    };
+    char port[6];
+    snprintf(port, sizeof(port), "%d", server_port);
+    const Str *content_length = get_header(request, "Content-Length");
+    const Str *content_type = get_header(request, "Content-Type");
+    const char *path = getenv("PATH");
+
+    env->count = 0;
+    env->used = 0;
+    env->vars[0] = NULL;
+#define ADD_VAR(name, value, length) add_cgi_var(env, name, sizeof(name) - 1, value, length)
+#define ADD_STRING(name, value) ADD_VAR(name, value, strlen(value))
+    ADD_STRING("GATEWAY_INTERFACE", "CGI/1.1");
+    ADD_VAR("REQUEST_METHOD", request->http_method.data, request->http_method.len);
+    ADD_VAR("CONTENT_LENGTH", content_length ? content_length->data : "", content_length ? content_length->len : 0);
+    ADD_VAR("CONTENT_TYPE", content_type ? content_type->data : "", content_type ? content_type->len : 0);
+    ADD_STRING("REMOTE_ADDR", client_ip);
+    ADD_VAR("REQUEST_URI", request->http_uri.data, request->http_uri.len);
+    ADD_STRING("SERVER_PORT", port);
+    ADD_STRING("SERVER_PROTOCOL", "HTTP/1.1");
+    ADD_STRING("SERVER_SOFTWARE", "MyHTTPServer/1.0");
+    ADD_STRING("QUERY_STRING", query);
+    ADD_STRING("SCRIPT_NAME", script);
+    ADD_STRING("SCRIPT_FILENAME", script);
+    ADD_STRING("PATH_INFO", "");
+    if (path) {
+        ADD_STRING("PATH", path);
+    }
+#undef ADD_STRING
+#undef ADD_VAR
+
+    for (int i = 0; i < request->header_count; ++i) {
+        Str name = request->headers[i].header_name;
+        char var[64] = "HTTP_";
+        size_t length = 5;
+
+        int keep = name.len > 0 && name.len < sizeof(var) - length;
+        for (size_t j = 0; keep && j < name.len; ++j) {
+            var[length++] = cgi_name_map[(unsigned char)name.data[j]];
+            keep = var[length - 1] != 0;
+        }
+        for (size_t k = 0; keep && k < sizeof(skipped) / sizeof(skipped[0]); ++k) {
+            keep = !str_caseeq(name, skipped[k]);
+        }
+        for (int earlier = 0; keep && earlier < i; ++earlier) {
+            Str other = request->headers[earlier].header_name;
+            keep = !(other.len == name.len && strncasecmp(other.data, name.data, name.len) == 0);
+        }
+        if (keep) {
+            Str value = request->headers[i].header_value;
+            add_cgi_var(env, var, length, value.data, value.len);
+        }
+    }
+}
+
+/**
+ * Moves what is left of a script's output from its pipe to the client
+ * with splice(), so the body never passes through user space. Returns 0
+ * at the end of the output, -1 if the client went away, and 1 if the
+ * socket cannot be spliced to and the rest has to be copied instead.
+ */
+int splice_to_socket(int sock, int pipe_fd) {
+    while (1) {
+        ssize_t n = splice(pipe_fd, NULL, sock, NULL, CGI_PIPE_SIZE, SPLICE_F_MOVE);
+        if (n > 0) {
+            continue;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EINVAL ? 1 : -1;
+    }
+}
+
+// The next piece of a script's output, from its pipe or FastCGI connection.
+ssize_t read_cgi_output(int fd, FcgiRequest *fcgi, char *buf, size_t size) {
+    return fcgi ? fcgi_read(fcgi, buf, size) : read(fd, buf, size);
+}
+
+/**
+ * Copies the script's response to the client. A 200 of a type that is
+ * compressed goes out gzipped if the client takes it, with the stream
+ * flushed after every read so output the script trickles out still
+ * arrives as it is produced.
+ */
+void relay_cgi_output(int sock, int fd, FcgiRequest *fcgi, Request *request, WorkQueue *queue) {
+    char head[CGI_HEAD_ROOM];
+    size_t head_length = 0;
+    size_t body_offset;
+    ssize_t n;
+
+    // The status line and headers are needed before anything is sent.
+    while (head_length < CGI_HEAD_SIZE &&
+           (n = read_cgi_output(fd, fcgi, head + head_length, CGI_HEAD_SIZE - head_length)) > 0) {
+        head_length += n;
+        head[head_length] = '\0';
+        if (strstr(head, "\r\n\r\n")) {
+            break;
+        }
+    }
+    head[head_length] = '\0';
+
+    char chunk[4096];
+    z_stream stream;
+    if (!prepare_cgi_head(head, &head_length, &body_offset, cgi_may_gzip(request), queue, &stream)) {
+        if (write_all(sock, head, head_length) < 0) {
+            return;
+        }
+        if (!fcgi && splice_to_socket(sock, fd) <= 0) {
+            return;
+        }
+        while ((n = read_cgi_output(fd, fcgi, chunk, sizeof(chunk))) > 0) {
+            if (write_all(sock, chunk, n) < 0) {
+                return;
+            }
+        }
+        return;
+    }
+
+    int failed = write_all(sock, head, body_offset) < 0 ||
+                 send_gzip(sock, &stream, head + body_offset, head_length - body_offset, Z_SYNC_FLUSH) < 0;
+    while (!failed && (n = read_cgi_output(fd, fcgi, chunk, sizeof(chunk))) > 0) {
+        failed = send_gzip(sock, &stream, chunk, n, Z_SYNC_FLUSH) < 0;
+    }
+    if (!failed) {
+        send_gzip(sock, &stream, NULL, 0, Z_FINISH);
+    }
+    deflateEnd(&stream);
+}
+
+// Whether a script's response may be gzipped for this request.
+int cgi_may_gzip(Request *request) {
+    return !str_eq(request->http_method, "HEAD") &&
+           choose_encoding(get_header(request, "Accept-Encoding"), 1 << ENCODING_GZIP) >= 0;
+}
+
+/**
+ * Gets the head of a script's response ready to send. head holds the
+ * head_length bytes read so far, NUL-terminated: the head and maybe the
+ * start of the body, in a buffer of CGI_HEAD_ROOM. A document response
+ * gets its status line. Returns 1 if the body is to be gzipped through
+ * stream, which is then set up and the head rewritten to say so, with
+ * *body_offset where the body starts; returns 0 to send everything as is.
+ */
+int prepare_cgi_head(char *head, size_t *head_length, size_t *body_offset, int may_gzip, WorkQueue *queue, z_stream *stream) {
+    char *body = strstr(head, "\r\n\r\n");
+    if (!body) {
+        return 0;
+    }
+    if (strncmp(head, "HTTP/", 5) != 0) {
+        *head_length = add_status_line(head, *head_length, CGI_HEAD_ROOM);
+        body = strstr(head, "\r\n\r\n");
+    }
+
+    int level = 0;
+    if (may_gzip &&
+        (strncmp(head, "HTTP/1.1 200", 12) == 0 || strncmp(head, "HTTP/1.0 200", 12) == 0) &&
+        !raw_header(head, body, "Content-Encoding")) {
+        const char *content_type = raw_header(head, body, "Content-Type");
+        level = content_type ? compress_level(compress_level_for(content_type), queue) : 0;
+    }
+    if (level == 0 || gzip_stream_init(stream, level) != Z_OK) {
+        return 0;
+    }
+
+    // Same headers less Content-Length, which no longer holds.
+    char *line = head;
+    while (line < body + 2) {
+        char *eol = strstr(line, "\r\n") + 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            memmove(line, eol, head + *head_length + 1 - eol);
+            *head_length -= eol - line;
+            body -= eol - line;
+        } else {
+            line = eol;
+        }
+    }
+    size_t coding_length = strlen(GZIP_CODING);
+    memmove(body + 2 + coding_length, body + 2, head + *head_length + 1 - (body + 2));
+    memcpy(body + 2, GZIP_CODING, coding_length);
+    *head_length += coding_length;
+    *body_offset = body + 4 + coding_length - head;
+    return 1;
+}
+
+/**
+ * Turns the head of a document response, which carries its status in a
+ * Status header (RFC 3875, 6.3.3) if at all, into an HTTP one by putting
+ * a status line in front. FastCGI applications always answer this way.
+ * Returns the new length; head has room for size bytes.
+ */
+size_t add_status_line(char *head, size_t head_length, size_t size) {
+    char status[64] = "200 OK";
+    char *end = strstr(head, "\r\n\r\n") + 2;
+
+    for (char *line = head; line < end; line = strstr(line, "\r\n") + 2) {
+        if (strncasecmp(line, "Status:", 7) == 0) {
+            char *eol = strstr(line, "\r\n") + 2;
+            const char *value = line + 7;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            snprintf(status, sizeof(status), "%.*s", (int)(eol - 2 - value), value);
+            memmove(line, eol, head + head_length + 1 - eol);
+            head_length -= eol - line;
+            break;
+        }
+    }
+
+    char status_line[96];
+    int length = snprintf(status_line, sizeof(status_line), "HTTP/1.1 %s\r\n", status);
+    if (head_length + length >= size) {
+        return head_length;
+    }
+    memmove(head + length, head, head_length + 1);
+    memcpy(head, status_line, length);
+    return head_length + length;
+}
+
+/**
+ * The value of header name in a raw response head that ends at end, or
+ * NULL. The value runs to the next CRLF.
+ */
+const char* raw_header(const char *head, const char *end, const char *name) {
+    size_t name_length = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n")) {
+        const char *start = line + 2;
+        if (strncasecmp(start, name, name_length) == 0 && start[name_length] == ':') {
+            start += name_length + 1;
+            while (*start == ' ' || *start == '\t') {
+                start++;
+            }
+            return start;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Feeds length bytes to a gzip stream and sends whatever comes out,
+ * flushing as flush says. Returns 0, or -1 if the client went away.
+ */
+int send_gzip(int sock, z_stream *stream, const char *data, size_t length, int flush) {
+    char out[STREAM_CHUNK_SIZE];
+
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = length;
+    do {
+        stream->next_out = (Bytef *)out;
+        stream->avail_out = sizeof(out);
+        deflate(stream, flush);
+        size_t produced = sizeof(out) - stream->avail_out;
+        if (produced > 0 && write_all(sock, out, produced) < 0) {
+            return -1;
+        }
+    } while (stream->avail_out == 0);
+    return 0;
+}
+
+const char* get_content_type(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (!dot) return "text/plain";
+
+    if (strcmp(dot, ".html") == 0 || strcmp(dot, ".htm") == 0) return "text/html";
+    else if (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0) return "image/jpeg";
+    else if (strcmp(dot, ".css") == 0) return "text/css";
+    else if (strcmp(dot, ".js") == 0) return "application/javascript";
+    else if (strcmp(dot, ".png") == 0) return "image/png";
+    else if (strcmp(dot, ".js") == 0) return "text/javascript";
+    else if (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0) return "image/jpg";
+    else if (strcmp(dot, ".gif") == 0) return "image/gif";
+    else return "text/plain";
+}
+
+/**
+ * Writes the whole buffer, riding out short writes. Returns 0 on success
+ * and -1 if the peer went away or the send timed out.
+ */
+int write_all(int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(sock, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Sends length bytes of fd starting at offset straight from the page cache.
+ * Falls back to bounded read/write chunks on filesystems that cannot
+ * sendfile(). Returns 0 on success, -1 if the transfer was cut short.
+ */
+int send_file(int sock, int fd, off_t offset, size_t length) {
+    while (length > 0) {
+        ssize_t n = sendfile(sock, fd, &offset, length);
+        if (n > 0) {
+            length -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            break;
+        }
+        return -1;
+    }
+
+    char chunk[STREAM_CHUNK_SIZE];
+    while (length > 0) {
+        ssize_t n = pread(fd, chunk, length < sizeof(chunk) ? length : sizeof(chunk), offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || write_all(sock, chunk, n) < 0) {
+            return -1;
+        }
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * Relays a file of unknown length using chunked transfer encoding, holding
+ * at most STREAM_CHUNK_SIZE bytes in memory at a time.
+ */
+int stream_file_chunked(int sock, int fd) {
+    char chunk[STREAM_CHUNK_SIZE];
+    char size_line[32];
+
+    while (1) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", n);
+        struct iovec iov[3] = {
+            { size_line, size_length },
+            { chunk, n },
+            { "\r\n", 2 },
+        };
+        if (sendv_all(sock, iov, 3, 0) < 0) {
+            return -1;
+        }
+    }
+
+    return write_all(sock, "0\r\n\r\n", 5);
+}
+
+/**
+ * Sends the whole iovec array with sendmsg() flags such as MSG_MORE,
+ * riding out short writes like write_all(). The array is used up in the
+ * process.
+ */
+int sendv_all(int sock, struct iovec *iov, int iovcnt, int flags) {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+
+    while (iovcnt > 0) {
+        message.msg_iov = iov;
+        message.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(sock, &message, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Serves a cache hit straight from memory: the per-request status, Date,
+ * Content-Type and extra_headers, the entry's prebuilt headers and its
+ * body go out in one writev().
+ */
+int send_cached(int sock, CacheEntry *entry, const char *content_type, const char *extra_headers, int keep_alive, int is_head) {
+    char status[512];
+    char date[128];
+    http_date(date, sizeof(date));
+    int status_length = snprintf(status, sizeof(status),
+        "HTTP/1.1 200 OK\r\n"
+        "Date: %s\r\n"
+        "Server: MyHTTPServer/1.0 (Unix)\r\n"
+        "Connection: %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s",
+        date, keep_alive ? "keep-alive" : "close", content_type, extra_headers);
+
+    struct iovec iov[3] = {
+        { status, status_length },
+        { (void *)entry->header, entry->header_length },
+        { (void *)entry->body, entry->body_length },
+    };
+    return sendv_all(sock, iov, is_head ? 2 : 3, 0);
+}
+
+/**
+ * Writes the current time for the Date header. It only changes once a
+ * second, so one worker formats it per second and the rest copy that
+ * text; the copy is a seqlock read, and a reader that races the writer
+ * formats its own.
+ */
+void http_date(char *buf, size_t size) {
+    static _Atomic unsigned sequence;
+    static _Atomic time_t second;
+    static _Atomic uint64_t words[4];  // the text, NUL-padded
+    uint64_t text[4];
+    time_t now = time(0);
+
+    unsigned begin = atomic_load_explicit(&sequence, memory_order_acquire);
+    if (!(begin & 1) && atomic_load_explicit(&second, memory_order_relaxed) == now) {
+        for (int i = 0; i < 4; ++i) {
+            text[i] = atomic_load_explicit(&words[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&sequence, memory_order_relaxed) == begin) {
+            snprintf(buf, size, "%s", (const char *)text);
+            return;
+        }
+    }
+
+    format_http_date(buf, size, now);
+    if (!(begin & 1) && size >= sizeof(text) &&
+        atomic_compare_exchange_strong(&sequence, &begin, begin + 1)) {
+        atomic_thread_fence(memory_order_release);
+        memset(text, 0, sizeof(text));
+        memcpy(text, buf, strnlen(buf, sizeof(text) - 1));
+        for (int i = 0; i < 4; ++i) {
+            atomic_store_explicit(&words[i], text[i], memory_order_relaxed);
+        }
+        atomic_store_explicit(&second, now, memory_order_relaxed);
+        atomic_store_explicit(&sequence, begin + 2, memory_order_release);
+    }
+}
+
+void format_http_date(char *buf, size_t size, time_t when) {
+    struct tm gmt;
+    gmtime_r(&when, &gmt);
+    strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+}
+
+/**
+ * Parses an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT". Returns 0
+ * on success, -1 for anything else (obsolete formats included).
+ */
+int parse_http_date(Str value, time_t *when) {
+    char copy[64];
+    struct tm tm;
+
+    if (value.len >= sizeof(copy)) {
+        return -1;
+    }
+    memcpy(copy, value.data, value.len);
+    copy[value.len] = '\0';
+
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(copy, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end) {
+        return -1;
+    }
+    *when = timegm(&tm);
+    return 0;
+}
+
+/**
+ * A strong ETag from the file's mtime and size, the same for every worker
+ * and across restarts, so it never needs the file's contents.
+ */
+void format_etag(char *buf, size_t size, const struct stat *st) {
+    snprintf(buf, size, "\"%llx.%lx-%llx\"",
+             (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec, (long long)st->st_size);
+}
+
+void format_validators(char *buf, size_t size, const char *etag, time_t mtime) {
+    char date[64];
+    format_http_date(date, sizeof(date), mtime);
+    snprintf(buf, size, "Last-Modified: %s\r\nETag: %s\r\n", date, etag);
+}
+
+/**
+ * Whether the client's copy is current (RFC 9110, 13.1.2 and 13.1.3).
+ * If-None-Match wins over If-Modified-Since; tags compare weakly.
+ */
+int is_not_modified(Request *request, const char *etag, time_t mtime) {
+    const Str *if_none_match = get_header(request, "If-None-Match");
+    if (if_none_match) {
+        const char *p = if_none_match->data;
+        const char *end = p + if_none_match->len;
+        size_t etag_length = strlen(etag);
+
+        while (p < end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+                p++;
+            }
+            const char *tag = p;
+            while (p < end && *p != ',') {
+                p++;
+            }
+            const char *tag_end = p;
+            while (tag_end > tag && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+                tag_end--;
+            }
+            if (tag_end - tag == 1 && *tag == '*') {
+                return 1;
+            }
+            if (tag_end - tag > 2 && tag[0] == 'W' && tag[1] == '/') {
+                tag += 2;
+            }
+            if ((size_t)(tag_end - tag) == etag_length && memcmp(tag, etag, etag_length) == 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    const Str *if_modified_since = get_header(request, "If-Modified-Since");
+    time_t since;
+    return if_modified_since && parse_http_date(*if_modified_since, &since) == 0 && mtime <= since;
+}
+
+int send_not_modified(int sock, const char *etag, time_t mtime, const char *extra_headers, int keep_alive) {
+    char header[512];
+    char date[64];
+    char validators[160];
+    http_date(date, sizeof(date));
+    format_validators(validators, sizeof(validators), etag, mtime);
+
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 304 Not Modified\r\n"
+        "Date: %s\r\n"
+        "Server: MyHTTPServer/1.0 (Unix)\r\n"
+        "Connection: %s\r\n"
+        "%s%s\r\n",
+        date, keep_alive ? "keep-alive" : "close", extra_headers, validators);
+    return write_all(sock, header, header_length);
+}
+
+int parse_offset(const char **p, const char *end, off_t *value) {
+    off_t result = 0;
+    if (*p >= end || !isdigit((unsigned char)**p)) {
+        return -1;
+    }
+    while (*p < end && isdigit((unsigned char)**p)) {
+        if (result > (LLONG_MAX - 9) / 10) {
+            return -1;
+        }
+        result = result * 10 + (**p - '0');
+        (*p)++;
+    }
+    *value = result;
+    return 0;
+}
+
+/**
+ * Works out which bytes of a size-byte file a GET asked for with Range
+ * (RFC 9110, 14.2). Returns the number of ranges stored, 0 if none of them
+ * can be satisfied, or -1 if the whole file should be sent: no Range, a
+ * malformed one, more than MAX_RANGES parts, or an If-Range that no longer
+ * matches the file.
+ */
+int requested_ranges(Request *request, const char *etag, time_t mtime, off_t size, ByteRange *ranges) {
+    const Str *range = get_header(request, "Range");
+    if (!range || !str_eq(request->http_method, "GET")) {
+        return -1;
+    }
+
+    const Str *if_range = get_header(request, "If-Range");
+    if (if_range) {
+        time_t date;
+        if (if_range->len > 0 && if_range->data[0] == '"') {
+            // Strong comparison: a weak tag never matches.
+            if (if_range->len != strlen(etag) || memcmp(if_range->data, etag, if_range->len) != 0) {
+                return -1;
+            }
+        } else if (parse_http_date(*if_range, &date) < 0 || date != mtime) {
+            return -1;
+        }
+    }
+
+    if (range->len < 6 || strncasecmp(range->data, "bytes=", 6) != 0) {
+        return -1;
+    }
+    const char *p = range->data + 6;
+    const char *end = range->data + range->len;
+    int specs = 0;
+    int count = 0;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+
+        off_t first;
+        off_t last = size - 1;
+        if (*p == '-') {
+            // "-n" is the last n bytes.
+            off_t suffix;
+            p++;
+            if (parse_offset(&p, end, &suffix) < 0) {
+                return -1;
+            }
+            if (suffix == 0) {
+                first = size;
+            } else {
+                first = suffix < size ? size - suffix : 0;
+            }
+        } else {
+            if (parse_offset(&p, end, &first) < 0 || p == end || *p++ != '-') {
+                return -1;
+            }
+            off_t requested_last;
+            if (p < end && isdigit((unsigned char)*p)) {
+                if (parse_offset(&p, end, &requested_last) < 0 || requested_last < first) {
+                    return -1;
+                }
+                if (requested_last < last) {
+                    last = requested_last;
+                }
+            }
+        }
+
+        if (++specs > MAX_RANGES) {
+            return -1;
+        }
+        if (first < size) {
+            ranges[count].first = first;
+            ranges[count].last = last;
+            count++;
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p < end && *p != ',') {
+            return -1;
+        }
+    }
+
+    return specs ? count : -1;
+}
+
+/**
+ * Answers a Range request with the given parts of the file, copied from
+ * body when it is cached in memory and sent from fd with sendfile()
+ * otherwise. One range goes out as a plain 206, several as
+ * multipart/byteranges, and none as a 416. extra_headers (validators,
+ * Content-Encoding) go on the 206.
+ */
+int send_ranges(int sock, ByteRange *ranges, int count, off_t size, const char *content_type, const char *extra_headers, int fd, const char *body, int keep_alive) {
+    static _Atomic unsigned long boundaries;
+    char headers[512];
+    char header[2048];
+    int header_length;
+
+    if (count == 0) {
+        static const char message[] = "<h1>416 Range Not Satisfiable</h1>";
+        snprintf(headers, sizeof(headers), "Content-Range: bytes */%lld\r\n", (long long)size);
+        header_length = format_headers(header, sizeof(header), "416 Range Not Satisfiable", "text/html", sizeof(message) - 1, keep_alive, headers);
+        return send_with_body(sock, header, header_length, -1, message, 0, sizeof(message) - 1);
+    }
+
+    if (count == 1) {
+        snprintf(headers, sizeof(headers), "Content-Range: bytes %lld-%lld/%lld\r\n%s",
+                 (long long)ranges[0].first, (long long)ranges[0].last, (long long)size, extra_headers);
+        header_length = format_headers(header, sizeof(header), "206 Partial Content", content_type, ranges[0].last - ranges[0].first + 1, keep_alive, headers);
+        return send_with_body(sock, header, header_length, fd, body, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+    }
+
+    char boundary[40];
+    char type[96];
+    char part[512];
+    snprintf(boundary, sizeof(boundary), "%08lx%08lx", (unsigned long)time(0), atomic_fetch_add(&boundaries, 1));
+    snprintf(type, sizeof(type), "multipart/byteranges; boundary=%s", boundary);
+
+    // Content-Length must cover every part header, so they are formatted
+    // once here to be counted and again when sent.
+    long long length = 0;
+    for (int i = 0; i < count; ++i) {
+        length += snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                           boundary, content_type, (long long)ranges[i].first, (long long)ranges[i].last, (long long)size);
+        length += ranges[i].last - ranges[i].first + 1;
+    }
+    int trailer_length = snprintf(part, sizeof(part), "\r\n--%s--\r\n", boundary);
+    length += trailer_length;
+
+    // Many small writes: corked, they leave in full segments.
+    set_cork(sock, 1);
+    int sent = send_headers(sock, "206 Partial Content", type, length, keep_alive, extra_headers);
+    for (int i = 0; i < count && sent == 0; ++i) {
+        int part_length = snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                   boundary, content_type, (long long)ranges[i].first, (long long)ranges[i].last, (long long)size);
+        sent = send_with_body(sock, part, part_length, fd, body, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    if (sent == 0) {
+        snprintf(part, sizeof(part), "\r\n--%s--\r\n", boundary);
+        sent = write_all(sock, part, trailer_length);
+    }
+    set_cork(sock, 0);
+    return sent;
+}
+
+/**
+ * Sends a file from the memory cache, whole or just the ranges asked for.
+ */
+int send_entry(int sock, Request *request, CacheEntry *entry, const char *content_type, const char *extra_headers, int keep_alive, int is_head) {
+    ByteRange ranges[MAX_RANGES];
+    int count = requested_ranges(request, entry->etag, entry->mtime.tv_sec, entry->body_length, ranges);
+    if (count < 0) {
+        return send_cached(sock, entry, content_type, extra_headers, keep_alive, is_head);
+    }
+
+    char validators[160];
+    char headers[320];
+    format_validators(validators, sizeof(validators), entry->etag, entry->mtime.tv_sec);
+    snprintf(headers, sizeof(headers), "%s%s", extra_headers, validators);
+    return send_ranges(sock, ranges, count, entry->body_length, content_type, headers, -1, entry->body, keep_alive);
+}
+
+/**
+ * Parses a byte count such as 65536, 512K or 64M. Returns -1 if invalid.
+ */
+long long parse_size(const char *arg) {
+    char *end;
+    errno = 0;
+    long long size = strtoll(arg, &end, 10);
+    if (errno || end == arg || size < 0) {
+        return -1;
+    }
+    switch (*end) {
+        case 'g': case 'G': size <<= 10; /* fall through */
+        case 'm': case 'M': size <<= 10; /* fall through */
+        case 'k': case 'K': size <<= 10; end++; break;
+        case '\0': break;
+        default: return -1;
+    }
+    return *end ? -1 : size;
+}
+
+/**
+ * Writes the status line and headers. A content_length of -1 announces a
+ * chunked body instead of a Content-Length, CONTENT_LENGTH_UNKNOWN leaves
+ * both out. extra_headers, if given, are complete CRLF-terminated lines
+ * added at the end.
+ */
+int send_headers(int sock, const char *status, const char *content_type, long long content_length, int keep_alive, const char *extra_headers) {
+    char header[2048];
+    int header_length = format_headers(header, sizeof(header), status, content_type, content_length, keep_alive, extra_headers);
+    return write_all(sock, header, header_length);
+}
+
+// The header block send_headers() writes, for sending along with a body.
+int format_headers(char *header, size_t size, const char *status, const char *content_type, long long content_length, int keep_alive, const char *extra_headers) {
+    char date[64];
+    http_date(date, sizeof(date));
+
+    int header_length = snprintf(header, size,
+        "HTTP/1.1 %s\r\n"
+        "Date: %s\r\n"
+        "Server: MyHTTPServer/1.0 (Unix)\r\n"
+        "Connection: %s\r\n"
+        "Content-Type: %s\r\n",
+        status, date, keep_alive ? "keep-alive" : "close", content_type);
+
+    if (content_length >= 0) {
+        header_length += snprintf(header + header_length, size - header_length,
+            "Content-Length: %lld\r\n", content_length);
+    } else if (content_length == -1) {
+        header_length += snprintf(header + header_length, size - header_length,
+            "Transfer-Encoding: chunked\r\n");
+    }
+    header_length += snprintf(header + header_length, size - header_length,
+        "%s\r\n", extra_headers ? extra_headers : "");
+    return header_length;
+}
+
+/**
+ * Sends a header block and the body after it so that they share segments:
+ * one writev() for a body in memory, or the header with MSG_MORE ahead of
+ * sendfile() for a body in fd. Without MSG_MORE the header would go out
+ * alone and Nagle would hold back the start of the body until the client's
+ * delayed ACK.
+ */
+int send_with_body(int sock, const char *header, size_t header_length, int fd, const char *body, off_t offset, size_t length) {
+    struct iovec iov[2] = {
+        { (void *)header, header_length },
+        { (void *)(body ? body + offset : NULL), length },
+    };
+    if (body || length == 0) {
+        return sendv_all(sock, iov, length ? 2 : 1, 0);
+    }
+    if (sendv_all(sock, iov, 1, MSG_MORE) < 0) {
+        return -1;
+    }
+    return send_file(sock, fd, offset, length);
+}
+
+// Holds partial segments back while a response is written in several parts.
+void set_cork(int sock, int on) {
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+void send_response(int sock, const char *status, const char *content_type, const char *body, size_t body_length, int keep_alive) {
+    char header[2048];
+    int header_length = format_headers(header, sizeof(header), status, content_type, body_length, keep_alive, NULL);
+    send_with_body(sock, header, header_length, -1, body, 0, body ? body_length : 0);
+}
+
+void send_error(int sock, const char *status, int keep_alive) {
+    char body[128];
+    int body_length = snprintf(body, sizeof(body), "<h1>%s</h1>", status);
+    send_response(sock, status, "text/html", body, body_length, keep_alive);
+}
@@ -1,91 +1,158 @@
-#include "parse.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-/**
- * Given a char buffer, returns the parsed request headers.
- */
-Request* parse(char *buffer, int size, int socketFd) {
-
-    enum {
-        STATE_START = 0, STATE_CR, STATE_CRLF, STATE_CRLFCR, STATE_CRLFCRLF
-    };
-
-    int i = 0, state;
-    size_t offset = 0;
-    char ch;
-    char buf[8192];
-    memset(buf, 0, 8192);
-
-    state = STATE_START;
-    while (state != STATE_CRLFCRLF) {
-        char expected = 0;
-
-        if (i == size)
-            break;
-
-        ch = buffer[i++];
-        
-        if (offset >= sizeof(buf) - 1) {
-            fprintf(stderr, "Buffer overflow detected\n");
-            return NULL;
-        }
-
-        buf[offset++] = ch;
-
-        switch (state) {
-            case STATE_START:
-            case STATE_CRLF:
-                expected = '\r';
-                break;
-            case STATE_CR:
-            case STATE_CRLFCR:
-                expected = '\n';
-                break;
-            default:
-                state = STATE_START;
-                continue;
-        }
-
-        if (ch == expected)
-            state++;
-        else
-            state = STATE_START;
-    }
-
-    if (state != STATE_CRLFCRLF) {
-        fprintf(stderr, "Debug: Malformed request\n");
-        return NULL;
-    }
-
-
-    Request *request = (Request *)malloc(sizeof(Request));
-    if (!request) {
-        perror("Failed to allocate memory for request");
-        return NULL;
-    }
-
-    memset(request, 0, sizeof(Request));
-    request->header_count = 0;
-
-    int initial_header_capacity = 10;
-    request->headers = (Request_header *)malloc(initial_header_capacity * sizeof(Request_header));
-    if (!request->headers) {
-        perror("Failed to allocate memory for request headers");
-        free(request);
-        return NULL;
-    }
-
-    yyrestart(NULL);
-    set_parsing_options(buf, i, request);
-
-    if (yyparse() != SUCCESS) {
-        fprintf(stderr, "Debug: Failed to parse request\n");
-        free(request->headers);
-        free(request);
-        return NULL;
-    }
-
-    return request;
-}
+#include "parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <limits.h>
+
+/* Each worker thread keeps one scanner and reuses it for every request. */
+static __thread yyscan_t scanner;
+
+/**
+ * Parses the request head in buffer into request, whose fields end up
+ * pointing into buffer. head_length is where the head ends, blank line
+ * included, as find_header_end() has already reported it; the grammar
+ * never sees the body or the next request behind it. Returns SUCCESS or
+ * -1 if the head is malformed.
+ */
+int parse(char *buffer, int head_length, int socketFd, Request *request) {
+    init_request(request);
+
+    if (!scanner && yylex_init_extra(NULL, &scanner) != 0) {
+        perror("Failed to create scanner");
+        return -1;
+    }
+
+    ParseState parse_state = { buffer, head_length, 0, 0, request };
+    yyset_extra(&parse_state, scanner);
+    yyrestart(NULL, scanner);
+
+    if (yyparse(scanner) != SUCCESS) {
+        fprintf(stderr, "Debug: Failed to parse request\n");
+        free_request(request);
+        return -1;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Fills in a request from the slices found by the state-machine parser, so
+ * the rest of the server does not care which engine parsed it.
+ */
+int request_from_parser(HttpParser *parser, const char *buf, Request *request) {
+    init_request(request);
+    request->http_method = make_str(buf + parser->method.offset, parser->method.length);
+    request->http_uri = make_str(buf + parser->uri.offset, parser->uri.length);
+    request->http_version = make_str(buf + parser->version.offset, parser->version.length);
+
+    for (int i = 0; i < parser->header_count; i++) {
+        HeaderSlice *header = &parser->headers[i];
+        if (add_header(request,
+                       make_str(buf + header->name.offset, header->name.length),
+                       make_str(buf + header->value.offset, header->value.length)) < 0) {
+            free_request(request);
+            return -1;
+        }
+    }
+
+    return SUCCESS;
+}
+
+// Header overflow blocks are only ever used by the worker parsing the
+// request, so each thread keeps its own free list and never locks.
+typedef struct HeaderBlock {
+    struct HeaderBlock *next;
+    Request_header headers[REQUEST_MAX_HEADERS];
+} HeaderBlock;
+
+static __thread HeaderBlock *header_pool;
+
+void init_request(Request *request) {
+    memset(request, 0, sizeof(*request));
+    request->headers = request->inline_headers;
+    request->header_capacity = REQUEST_INLINE_HEADERS;
+}
+
+/**
+ * Appends a header, moving the headers into a pooled block when the inline
+ * array is full. Returns -1 once REQUEST_MAX_HEADERS is reached.
+ */
+int add_header(Request *request, Str name, Str value) {
+    if (request->header_count == request->header_capacity) {
+        if (request->headers != request->inline_headers) {
+            return -1;
+        }
+
+        HeaderBlock *block = header_pool;
+        if (block) {
+            header_pool = block->next;
+        } else if (!(block = malloc(sizeof(HeaderBlock)))) {
+            return -1;
+        }
+        memcpy(block->headers, request->inline_headers, sizeof(request->inline_headers));
+        request->headers = block->headers;
+        request->header_capacity = REQUEST_MAX_HEADERS;
+    }
+
+    request->headers[request->header_count].header_name = name;
+    request->headers[request->header_count].header_value = value;
+    request->header_count++;
+    return 0;
+}
+
+/**
+ * Returns the value of the first header matching name (case-insensitively),
+ * or NULL if the request does not carry it.
+ */
+const Str* get_header(Request *request, const char *name) {
+    for (int i = 0; i < request->header_count; i++) {
+        if (str_caseeq(request->headers[i].header_name, name)) {
+            return &request->headers[i].header_value;
+        }
+    }
+    return NULL;
+}
+
+void free_request(Request *request) {
+    if (request->headers != request->inline_headers) {
+        HeaderBlock *block = (HeaderBlock *)((char *)request->headers - offsetof(HeaderBlock, headers));
+        block->next = header_pool;
+        header_pool = block;
+    }
+    request->headers = request->inline_headers;
+    request->header_capacity = REQUEST_INLINE_HEADERS;
+    request->header_count = 0;
+}
+
+Str make_str(const char *data, size_t len) {
+    Str s = { data, len };
+    return s;
+}
+
+int str_eq(Str s, const char *lit) {
+    return strlen(lit) == s.len && memcmp(s.data, lit, s.len) == 0;
+}
+
+int str_caseeq(Str s, const char *lit) {
+    return strlen(lit) == s.len && strncasecmp(s.data, lit, s.len) == 0;
+}
+
+/**
+ * Parses a non-negative decimal number such as a Content-Length. Returns -1
+ * if the view holds anything else or the value does not fit.
+ */
+long str_to_long(Str s) {
+    long value = 0;
+    if (s.len == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < s.len; i++) {
+        if (s.data[i] < '0' || s.data[i] > '9' || value > (LONG_MAX - 9) / 10) {
+            return -1;
+        }
+        value = value * 10 + (s.data[i] - '0');
+    }
+    return value;
+}
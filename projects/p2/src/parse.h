@@ -1,36 +1,87 @@
+#ifndef PARSE_H
+#define PARSE_H
+
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "http_parser.h"
 
 #define SUCCESS 0
 
+// Engines that can parse a request head; chosen with --parser.
+#define PARSER_YACC 0
+#define PARSER_FSM 1
+
+// A view into the receive buffer. Not NUL-terminated, and only valid
+// until the buffer is reused for the next request.
+typedef struct
+{
+	const char *data;
+	size_t len;
+} Str;
+
 //Header field
 typedef struct
 {
-	char header_name[4096];
-	char header_value[4096];
+	Str header_name;
+	Str header_value;
 } Request_header;
 
+// Most requests fit in the inline array; the rest borrow a block of
+// REQUEST_MAX_HEADERS entries from a per-thread pool.
+#define REQUEST_INLINE_HEADERS 8
+#define REQUEST_MAX_HEADERS HTTP_MAX_HEADERS
+
 //HTTP Request Header
 typedef struct
 {
-	char http_version[50];
-	char http_method[50];
-	char http_uri[4096];
-	Request_header *headers;
+	Str http_version;
+	Str http_method;
+	Str http_uri;
+	Request_header *headers;  // inline_headers, or a pooled block once they run out
 	int header_count;
-	char query_string[4096];  // Add query string field
-    char content_length[4096];  // Add content length field
-    char content_type[4096];    // Add content type field
-    char *body;               // For storing the body of POST requests
-    size_t body_length;       // Length of the body
+	int header_capacity;
+	Request_header inline_headers[REQUEST_INLINE_HEADERS];
+	const char *body;         // the body of POST requests, also in the receive buffer
+	size_t body_length;
 } Request;
 
-Request* parse(char *buffer, int size,int socketFd);
+int parse(char *buffer, int head_length, int socketFd, Request *request);
+int request_from_parser(HttpParser *parser, const char *buf, Request *request);
+void init_request(Request *request);
+int add_header(Request *request, Str name, Str value);
+const Str* get_header(Request *request, const char *name);
+// releases the header overflow block, if any; the Request itself is the caller's
+void free_request(Request *request);
+
+Str make_str(const char *data, size_t len);
+int str_eq(Str s, const char *lit);
+int str_caseeq(Str s, const char *lit);
+long str_to_long(Str s);
+
+// Everything the scanner needs to parse one request; handed to it as its
+// extra data so that no parsing state is shared between threads.
+typedef struct
+{
+	const char *buf;          // the request head, read in place
+	size_t buf_siz;
+	size_t offset;
+	size_t pos;               // where the next token starts
+	Request *request;
+} ParseState;
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
 
 // functions decalred in parser.y
-int yyparse();
-void set_parsing_options(char *buf, size_t i, Request *request);
+int yyparse(yyscan_t scanner);
+// functions generated from lexer.l
+int yylex_init_extra(ParseState *state, yyscan_t *scanner);
+ParseState *yyget_extra(yyscan_t scanner);
+void yyset_extra(ParseState *state, yyscan_t scanner);
 // to allow resetting the parser the request failed to properly parse
-void yyrestart(FILE *input_file);
-void free_request(Request *request); 
+void yyrestart(FILE *input_file, yyscan_t scanner);
+
+#endif
@@ -17,20 +17,44 @@
 #define YPRINTF(...)
 #endif
 
-void yyerror (const char *s);
-void set_parsing_options(char *buf, size_t siz, Request *parsing_request);
-extern int yylex();
+%}
 
-char *parsing_buf;
-int parsing_offset;
-size_t parsing_buf_siz;
-Request *parsing_request;
+%code requires {
+#include "parse.h"
+}
 
-%}
+%code {
+void yyerror (yyscan_t scanner, const char *s);
+extern int yylex(YYSTYPE *yylval_param, yyscan_t scanner);
+
+/* The request being filled in lives in the scanner's extra data. */
+#define parsing_state (yyget_extra(scanner))
+#define parsing_request (parsing_state->request)
+
+/* Turns a span of the input into a view of the caller's buffer. */
+#define VIEW(span) make_str(parsing_state->buf + (span).offset, (span).length)
+
+/* The span running from the start of first to the end of last. */
+static Slice join(Slice first, Slice last) {
+    Slice s = { first.offset, last.offset + last.length - first.offset };
+    return s;
+}
+}
+
+/*
+ * A pure parser keeps its state on the stack of yyparse() and the scanner
+ * keeps its own in a yyscan_t, so concurrent parses do not share anything.
+ */
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner}
 
+/*
+ * Tokens and rules only carry where they sit in the input. Nothing is
+ * copied until the request is filled in, and then only as views.
+ */
 %union {
-    char str[8192];
-    int i;
+    Slice span;
 }
 
 %start request
@@ -48,83 +72,89 @@ Request *parsing_request;
 %token t_ws
 %token t_ctl
 
-%type<str> t_crlf
-%type<i> t_backslash
-%type<i> t_slash
-%type<i> t_digit
-%type<i> t_dot
-%type<i> t_token_char
-%type<str> t_lws
-%type<i> t_colon
-%type<i> t_separators
-%type<i> t_sp
-%type<str> t_ws
-%type<i> t_ctl
-
-%type<i> allowed_char_for_token
-%type<i> allowed_char_for_text
-%type<str> ows
-%type<str> token
-%type<str> text
+%type<span> t_crlf
+%type<span> t_backslash
+%type<span> t_slash
+%type<span> t_digit
+%type<span> t_dot
+%type<span> t_token_char
+%type<span> t_lws
+%type<span> t_colon
+%type<span> t_separators
+%type<span> t_sp
+%type<span> t_ws
+%type<span> t_ctl
+
+%type<span> allowed_char_for_token
+%type<span> allowed_char_for_text
+%type<span> ows
+%type<span> token
+%type<span> text
 
 %%
 
 allowed_char_for_token:
     t_token_char |
-    t_digit { $$ = '0' + $1; } |
+    t_digit |
     t_dot;
 
 token:
     allowed_char_for_token {
         YPRINTF("token: Matched rule 1.\n");
-        snprintf($$, 8192, "%c", $1);
+        $$ = $1;
     } |
     token allowed_char_for_token {
         YPRINTF("token: Matched rule 2.\n");
-        snprintf($$ + strlen($1), 8192 - strlen($1), "%c", $2);
+        $$ = join($1, $2);
     };
 
 allowed_char_for_text:
     allowed_char_for_token |
-    t_separators { $$ = $1; } |
-    t_colon { $$ = $1; } |
-    t_slash { $$ = $1; };
+    t_separators |
+    t_colon |
+    t_slash;
 
 text: allowed_char_for_text {
     YPRINTF("text: Matched rule 1.\n");
-    snprintf($$, 8192, "%c", $1);
+    $$ = $1;
 } |
 text ows allowed_char_for_text {
     YPRINTF("text: Matched rule 2.\n");
-    snprintf($$ + strlen($1) + strlen($2), 8192 - strlen($1) - strlen($2), "%c", $3);
+    $$ = join($1, $3);
 };
 
 ows:
     /* Empty */ {
         YPRINTF("OWS: Matched rule 1\n");
-        $$[0] = 0;
+        $$.offset = 0;
+        $$.length = 0;
     } |
     t_sp {
         YPRINTF("OWS: Matched rule 2\n");
-        snprintf($$, 8192, "%c", $1);
+        $$ = $1;
     } |
     t_ws {
         YPRINTF("OWS: Matched rule 3\n");
-        snprintf($$, 8192, "%s", $1);
+        $$ = $1;
     };
 
 request_line: token t_sp text t_sp text t_crlf {
-    YPRINTF("Debug: Parsing Request Line: Method=%s, URI=%s, Version=%s\n", $1, $3, $5);
-    strcpy(parsing_request->http_method, $1);
-    strcpy(parsing_request->http_uri, $3);
-    strcpy(parsing_request->http_version, $5);
+    YPRINTF("Debug: Parsing Request Line: Method=%.*s, URI=%.*s, Version=%.*s\n",
+            (int)$1.length, parsing_state->buf + $1.offset,
+            (int)$3.length, parsing_state->buf + $3.offset,
+            (int)$5.length, parsing_state->buf + $5.offset);
+    parsing_request->http_method = VIEW($1);
+    parsing_request->http_uri = VIEW($3);
+    parsing_request->http_version = VIEW($5);
 };
 
-single_header: token ows t_colon ows text t_crlf {
-    YPRINTF("Debug: Parsing Header: Name=%s, Value=%s\n", $1, $5);
-    strcpy(parsing_request->headers[parsing_request->header_count].header_name, $1);
-    strcpy(parsing_request->headers[parsing_request->header_count].header_value, $5);
-    parsing_request->header_count++;
+single_header: token ows t_colon ows text ows t_crlf {
+    YPRINTF("Debug: Parsing Header: Name=%.*s, Value=%.*s\n",
+            (int)$1.length, parsing_state->buf + $1.offset,
+            (int)$5.length, parsing_state->buf + $5.offset);
+    if (add_header(parsing_request, VIEW($1), VIEW($5)) < 0) {
+        YYABORT;
+    }
 };
 
 request_header: single_header | request_header single_header;
@@ -136,14 +166,7 @@ request: request_line request_header t_crlf {
 
 %%
 
-void set_parsing_options(char *buf, size_t siz, Request *request) {
-    parsing_buf = buf;
-    parsing_offset = 0;
-    parsing_buf_siz = siz;
-    parsing_request = request;
-}
-
-void yyerror (const char *s) {
+void yyerror (yyscan_t scanner, const char *s) {
     fprintf(stderr, "Debug: Parser Error: %s\n", s);
     fprintf(stderr, "%s\n", s);
 }
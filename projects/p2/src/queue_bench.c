@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "thread_pool.h"
+
+/*
+ * Compares the lock-free WorkQueue with the mutex/condvar ring it replaced.
+ * Half the threads produce, half consume; each run moves the same number of
+ * items through a queue of the server's default capacity. Afterwards it
+ * checks that bursts arriving while every consumer is parked all get taken.
+ *
+ *   ./queue_bench [items] [max_threads]
+ */
+
+#define CAPACITY 100
+
+// The previous WorkQueue, kept here as the baseline.
+typedef struct {
+    WorkItem* items;
+    int capacity;
+    int count;
+    int front;
+    int rear;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_var;
+} MutexQueue;
+
+static void mutex_init(MutexQueue *queue, int capacity) {
+    queue->items = malloc(sizeof(WorkItem) * capacity);
+    queue->capacity = capacity;
+    queue->count = 0;
+    queue->front = 0;
+    queue->rear = -1;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond_var, NULL);
+}
+
+static int mutex_enqueue(MutexQueue *queue, struct Connection *conn) {
+    int ok = 0;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count < queue->capacity) {
+        queue->rear = (queue->rear + 1) % queue->capacity;
+        queue->items[queue->rear].conn = conn;
+        queue->count++;
+        ok = 1;
+        pthread_cond_signal(&queue->cond_var);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return ok ? 0 : -1;
+}
+
+static WorkItem mutex_dequeue(MutexQueue *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->cond_var, &queue->mutex);
+    }
+    WorkItem item = queue->items[queue->front];
+    queue->front = (queue->front + 1) % queue->capacity;
+    queue->count--;
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+typedef struct {
+    int lock_free;
+    MutexQueue mutex_queue;
+    WorkQueue *queue;
+    long items_per_producer;
+    _Atomic long consumed;
+} Bench;
+
+// Item values start at 1; NULL tells a consumer to stop.
+static void push(Bench *bench, struct Connection *conn) {
+    while ((bench->lock_free ? enqueue_work(bench->queue, conn)
+                             : mutex_enqueue(&bench->mutex_queue, conn)) < 0) {
+        sched_yield();
+    }
+}
+
+static void* producer(void *arg) {
+    Bench *bench = arg;
+    for (long i = 1; i <= bench->items_per_producer; ++i) {
+        push(bench, (struct Connection *)i);
+    }
+    return NULL;
+}
+
+static void* consumer(void *arg) {
+    Bench *bench = arg;
+    for (;;) {
+        WorkItem item = bench->lock_free ? dequeue_work(bench->queue) : mutex_dequeue(&bench->mutex_queue);
+        if (!item.conn) {
+            return NULL;
+        }
+        atomic_fetch_add(&bench->consumed, 1);
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int lock_free, int threads, long items) {
+    int producers = threads > 1 ? threads / 2 : 1;
+    int consumers = threads > 1 ? threads - producers : 1;
+    pthread_t tids[producers + consumers];
+    Bench bench;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.lock_free = lock_free;
+    bench.items_per_producer = items / producers;
+    if (lock_free) {
+        bench.queue = aligned_alloc(64, sizeof(WorkQueue));
+        init_work_queue(bench.queue, CAPACITY);
+    } else {
+        mutex_init(&bench.mutex_queue, CAPACITY);
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < consumers; ++i) {
+        pthread_create(&tids[producers + i], NULL, consumer, &bench);
+    }
+    for (int i = 0; i < producers; ++i) {
+        pthread_create(&tids[i], NULL, producer, &bench);
+    }
+    for (int i = 0; i < producers; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    for (int i = 0; i < consumers; ++i) {
+        push(&bench, NULL);
+    }
+    for (int i = 0; i < consumers; ++i) {
+        pthread_join(tids[producers + i], NULL);
+    }
+    double elapsed = now_sec() - start;
+
+    if (lock_free) {
+        free_work_queue(bench.queue);
+        free(bench.queue);
+    } else {
+        free(bench.mutex_queue.items);
+    }
+    return bench.items_per_producer * producers / elapsed;
+}
+
+static void pause_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Lets every consumer park, then sends a burst, over and over. A lost
+ * wakeup shows up as items left in the queue with all consumers asleep.
+ * Returns the number of the burst that got stuck, or 0.
+ */
+static int parked_bursts(int consumers, int bursts) {
+    pthread_t tids[consumers];
+    Bench bench;
+    int stuck = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.lock_free = 1;
+    bench.queue = aligned_alloc(64, sizeof(WorkQueue));
+    init_work_queue(bench.queue, CAPACITY);
+    for (int i = 0; i < consumers; ++i) {
+        pthread_create(&tids[i], NULL, consumer, &bench);
+    }
+
+    long sent = 0;
+    for (int burst = 1; burst <= bursts && !stuck; ++burst) {
+        while (atomic_load(&bench.queue->sleepers) < consumers) {
+            pause_ms(1);
+        }
+        // Vary the size so bursts land both below and above the consumer count.
+        for (int i = 0; i <= burst % (2 * consumers + 1); ++i) {
+            push(&bench, (struct Connection *)1);
+            ++sent;
+        }
+        for (int waited = 0; atomic_load(&bench.consumed) < sent; ++waited) {
+            if (waited == 2000) {
+                stuck = burst;
+                break;
+            }
+            pause_ms(1);
+        }
+    }
+
+    if (!stuck) {
+        for (int i = 0; i < consumers; ++i) {
+            push(&bench, NULL);
+        }
+        for (int i = 0; i < consumers; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        free_work_queue(bench.queue);
+        free(bench.queue);
+    }
+    return stuck;
+}
+
+int main(int argc, char **argv) {
+    long items = argc > 1 ? atol(argv[1]) : 1000000;
+    int max_threads = argc > 2 ? atoi(argv[2]) : 64;
+
+    printf("%8s %16s %16s %8s\n", "threads", "mutex (ops/s)", "lock-free (ops/s)", "speedup");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double mutex_rate = run(0, threads, items);
+        double lock_free_rate = run(1, threads, items);
+        printf("%8d %16.0f %16.0f %7.2fx\n", threads, mutex_rate, lock_free_rate, lock_free_rate / mutex_rate);
+    }
+
+    for (int consumers = 1; consumers <= max_threads; consumers *= 2) {
+        int stuck = parked_bursts(consumers, 200);
+        if (stuck) {
+            printf("parked bursts, %d consumers: stuck at burst %d\n", consumers, stuck);
+            return 1;
+        }
+        printf("parked bursts, %d consumers: ok\n", consumers);
+    }
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include "root_watch.h"
+#include "encoding.h"
+
+#define WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+                      IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define WATCH_MAX_DEPTH 32            // bounds symlink loops in the tree
+
+static void evict(RootWatch *watch, const char *name) {
+    if (watch->cache) {
+        file_cache_invalidate(watch->cache, name);
+    }
+    if (watch->fd_cache) {
+        fd_cache_invalidate(watch->fd_cache, name);
+    }
+}
+
+// Without a complete set of watches the caches go back to checking
+// files with stat() once their revalidation interval is up.
+static void set_watched(RootWatch *watch, int watched) {
+    if (watch->cache) {
+        atomic_store(&watch->cache->watched, watched);
+    }
+    if (watch->fd_cache) {
+        atomic_store(&watch->fd_cache->watched, watched);
+    }
+}
+
+static int remember_dir(RootWatch *watch, int wd, const char *path) {
+    if (wd >= watch->dir_capacity) {
+        int capacity = watch->dir_capacity ? watch->dir_capacity : 64;
+        while (capacity <= wd) {
+            capacity *= 2;
+        }
+        char **dirs = realloc(watch->dirs, sizeof(char *) * capacity);
+        if (!dirs) {
+            return -1;
+        }
+        memset(dirs + watch->dir_capacity, 0, sizeof(char *) * (capacity - watch->dir_capacity));
+        watch->dirs = dirs;
+        watch->dir_capacity = capacity;
+    }
+    free(watch->dirs[wd]);
+    watch->dirs[wd] = strdup(path);
+    return watch->dirs[wd] ? 0 : -1;
+}
+
+// Watches path and every directory below it.
+static int add_tree(RootWatch *watch, const char *path, int depth) {
+    if (depth > WATCH_MAX_DEPTH) {
+        return 0;
+    }
+
+    int wd = inotify_add_watch(watch->fd, path, WATCH_EVENTS);
+    if (wd < 0 || remember_dir(watch, wd, path) < 0) {
+        return -1;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    struct dirent *ent;
+    int result = 0;
+    while (result == 0 && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        if (ent->d_type != DT_DIR && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN) {
+            continue;
+        }
+
+        char child[8192];
+        struct stat st;
+        snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+            result = add_tree(watch, child, depth + 1);
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+static void handle_event(RootWatch *watch, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so anything may have changed.
+        evict(watch, NULL);
+        return;
+    }
+    if (event->mask & IN_IGNORED) {
+        if (event->wd >= 0 && event->wd < watch->dir_capacity) {
+            free(watch->dirs[event->wd]);
+            watch->dirs[event->wd] = NULL;
+        }
+        return;
+    }
+
+    const char *parent = event->wd < watch->dir_capacity ? watch->dirs[event->wd] : NULL;
+    char child[8192];
+    struct stat st;
+    int link = 0;
+    if (event->len && parent) {
+        snprintf(child, sizeof(child), "%s/%s", parent, event->name);
+        link = (event->mask & (IN_CREATE | IN_MOVED_TO)) && lstat(child, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if ((event->mask & IN_ISDIR) || (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) || link) {
+        // A directory or symlink appeared, moved or went away: every
+        // cached path through it may now name something else. Paths
+        // through a link that merely goes away are revalidated with stat()
+        // anyway, see path_in_tree().
+        evict(watch, NULL);
+
+        if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len && parent &&
+            stat(child, &st) == 0 && S_ISDIR(st.st_mode) && add_tree(watch, child, 0) < 0) {
+            perror("inotify_add_watch");
+            fprintf(stderr, "Cannot watch %s, caches fall back to stat()\n", child);
+            set_watched(watch, 0);
+        }
+        return;
+    }
+
+    if (event->len) {
+        evict(watch, event->name);
+
+        // The original file's entry remembers which sidecars it has.
+        char base[NAME_MAX + 1];
+        if (sidecar_base(event->name, base, sizeof(base))) {
+            evict(watch, base);
+        }
+    }
+}
+
+static void* root_watch_thread(void *arg) {
+    RootWatch *watch = (RootWatch *)arg;
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t n = read(watch->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("read(inotify)");
+            set_watched(watch, 0);
+            return NULL;
+        }
+
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            handle_event(watch, event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Watches every directory under root and starts the thread that evicts
+ * changed files from the caches. Returns -1 with errno set if inotify is
+ * unavailable or the tree could not be watched in full (for instance
+ * because of fs.inotify.max_user_watches); the caches then keep
+ * revalidating with stat().
+ */
+int start_root_watch(RootWatch *watch, const char *root, FileCache *cache, FdCache *fd_cache) {
+    watch->fd = inotify_init1(IN_CLOEXEC);
+    if (watch->fd < 0) {
+        return -1;
+    }
+    watch->dirs = NULL;
+    watch->dir_capacity = 0;
+    watch->cache = cache;
+    watch->fd_cache = fd_cache;
+
+    if (add_tree(watch, root, 0) < 0) {
+        int saved = errno;
+        close(watch->fd);
+        for (int i = 0; i < watch->dir_capacity; ++i) {
+            free(watch->dirs[i]);
+        }
+        free(watch->dirs);
+        errno = saved;
+        return -1;
+    }
+
+    // Only files that resolve under the root are covered by the watches.
+    char *resolved = realpath(root, NULL);
+    if (cache) {
+        cache->watched_root = resolved;
+    }
+    if (fd_cache) {
+        fd_cache->watched_root = resolved;
+    }
+    set_watched(watch, 1);
+    pthread_create(&watch->thread, NULL, root_watch_thread, watch);
+    return 0;
+}
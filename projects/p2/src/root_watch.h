@@ -0,0 +1,21 @@
+#ifndef ROOT_WATCH_H
+#define ROOT_WATCH_H
+
+#include <pthread.h>
+#include "file_cache.h"
+#include "fd_cache.h"
+
+// Follows changes under the document root with inotify and evicts what
+// the caches hold for them, so cache hits never need to stat().
+typedef struct {
+    int fd;
+    char **dirs;                      // watched directory by watch descriptor
+    int dir_capacity;
+    FileCache *cache;
+    FdCache *fd_cache;
+    pthread_t thread;
+} RootWatch;
+
+int start_root_watch(RootWatch *watch, const char *root, FileCache *cache, FdCache *fd_cache);
+
+#endif
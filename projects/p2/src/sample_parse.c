@@ -5,29 +5,100 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "parse.h"
+#include "header_scan.h"
 
-int main(int argc, char **argv){
-  //Read from the file the sample
-  int fd_in = open(argv[1], O_RDONLY);
+void print_request(const char *engine, Request *request){
   int index;
-  char buf[8192];
-	if(fd_in < 0) {
-		printf("Failed to open the file\n");
-		return 0;
-	}
-  int readRet = read(fd_in,buf,8192);
-  //Parse the buffer to the parse function. You will need to pass the socket fd and the buffer would need to
-  //be read from that fd
-  Request *request = parse(buf,readRet,fd_in);
-  //Just printing everything
-  printf("Http Method %s\n",request->http_method);
-  printf("Http Version %s\n",request->http_version);
-  printf("Http Uri %s\n",request->http_uri);
+  if(request == NULL) {
+    printf("[%s] rejected\n", engine);
+    return;
+  }
+  printf("[%s] Http Method %.*s\n", engine, (int)request->http_method.len, request->http_method.data);
+  printf("[%s] Http Version %.*s\n", engine, (int)request->http_version.len, request->http_version.data);
+  printf("[%s] Http Uri %.*s\n", engine, (int)request->http_uri.len, request->http_uri.data);
   for(index = 0;index < request->header_count;index++){
-    printf("Request Header\n");
-    printf("Header name %s Header Value %s\n",request->headers[index].header_name,request->headers[index].header_value);
+    Request_header *header = &request->headers[index];
+    printf("[%s] Header name %.*s Header Value %.*s\n", engine, (int)header->header_name.len, header->header_name.data,
+           (int)header->header_value.len, header->header_value.data);
+  }
+}
+
+int same_str(Str a, Str b){
+  return a.len == b.len && memcmp(a.data, b.data, a.len) == 0;
+}
+
+int same_request(Request *a, Request *b){
+  int index;
+  if(a == NULL || b == NULL)
+    return a == b;
+  if(!same_str(a->http_method, b->http_method) || !same_str(a->http_version, b->http_version) ||
+     !same_str(a->http_uri, b->http_uri) || a->header_count != b->header_count)
+    return 0;
+  for(index = 0;index < a->header_count;index++){
+    if(!same_str(a->headers[index].header_name, b->headers[index].header_name) ||
+       !same_str(a->headers[index].header_value, b->headers[index].header_value))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Runs every sample through both parser engines and checks that they agree.
+ * The state-machine parser is also fed one byte at a time, the way a slow
+ * client would deliver the request, to exercise resuming.
+ */
+int main(int argc, char **argv){
+  int failures = 0;
+  int arg;
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s sample...\n", argv[0]);
+    return 1;
+  }
+  for(arg = 1;arg < argc;arg++){
+    //Read from the file the sample
+    int fd_in = open(argv[arg], O_RDONLY);
+    char buf[8192];
+    if(fd_in < 0) {
+      printf("Failed to open the file %s\n", argv[arg]);
+      failures++;
+      continue;
+    }
+    int readRet = read(fd_in,buf,8192);
+    close(fd_in);
+    if(readRet < 0)
+      readRet = 0;
+
+    Request yacc, fsm, split;
+    long head_length = find_header_end(buf,readRet,NULL);
+    Request *yacc_request = head_length >= 0 && parse(buf,head_length,fd_in,&yacc) == SUCCESS ? &yacc : NULL;
+
+    HttpParser whole, bytewise;
+    http_parser_init(&whole);
+    int rc = http_parser_execute(&whole, buf, readRet);
+    Request *fsm_request = rc == HTTP_PARSE_DONE && request_from_parser(&whole, buf, &fsm) == SUCCESS ? &fsm : NULL;
+
+    http_parser_init(&bytewise);
+    int len, split_rc = HTTP_PARSE_AGAIN;
+    for(len = 1;len <= readRet && split_rc == HTTP_PARSE_AGAIN;len++)
+      split_rc = http_parser_execute(&bytewise, buf, len);
+    Request *split_request = split_rc == HTTP_PARSE_DONE && request_from_parser(&bytewise, buf, &split) == SUCCESS ? &split : NULL;
+
+    printf("== %s\n", argv[arg]);
+    print_request("yacc", yacc_request);
+    if(same_request(yacc_request, fsm_request) && same_request(fsm_request, split_request) && whole.pos == bytewise.pos) {
+      printf("OK\n");
+    } else {
+      print_request("fsm", fsm_request);
+      print_request("fsm, byte at a time", split_request);
+      printf("MISMATCH\n");
+      failures++;
+    }
+    if(yacc_request)
+      free_request(yacc_request);
+    if(fsm_request)
+      free_request(fsm_request);
+    if(split_request)
+      free_request(split_request);
   }
-  free(request->headers);
-  free(request);
-  return 0;
+  return failures ? 1 : 0;
 }
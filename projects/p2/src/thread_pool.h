@@ -1,17 +1,41 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct Connection;
+struct FileCache;
+struct FdCache;
+struct FcgiPool;
+struct Zygote;
+struct CgiLoop;
 
 typedef struct {
-    int socket_fd;
+    struct Connection *conn;
 } WorkItem;
 
+// One slot of the ring. sequence says whose turn it is: equal to the
+// position when a producer may fill it, position + 1 once it holds an item.
 typedef struct {
-    WorkItem* items;
-    int capacity;
-    int count;
-    int front;
-    int rear;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_var;
+    _Atomic size_t sequence;
+    WorkItem item;
+} WorkCell;
+
+// Bounded lock-free multi-producer/multi-consumer ring (Vyukov's design).
+// Idle workers sleep on a futex instead of a mutex/condvar pair.
+typedef struct {
+    WorkCell *cells;
+    size_t mask;                                 // ring size - 1; the ring is a power of two
+    size_t limit;                                // admitted items at most, <= ring size
+    _Alignas(64) _Atomic size_t enqueue_pos;
+    _Alignas(64) _Atomic size_t dequeue_pos;
+    _Alignas(64) _Atomic uint32_t wakeups;       // futex word, bumped on every enqueue
+    _Atomic int sleepers;                        // workers parked or about to park
+    int spins;                                   // polls before parking; 0 on a single CPU
+    int workers;                                 // threads consuming from the ring
 } WorkQueue;
 
 typedef struct {
@@ -25,10 +49,28 @@ typedef struct {
     char *wwwRoot;
     int timeout;
     char* cgi_script_path;
-    int server_port;  
+    int server_port;
+    int keep_alive_timeout;
+    int max_requests;
+    int parser;
+    struct FileCache *cache;      // NULL when --cacheSize is 0
+    struct FdCache *fd_cache;     // NULL when --fdCacheSize is 0
+    struct FcgiPool *fastcgi;     // NULL unless --fastcgi is given
+    struct Zygote *zygote;        // NULL unless --zygote is given
+    struct CgiLoop *cgi_loops;    // take over running CGI scripts; NULL with --fastcgi
+    int num_cgi_loops;
 } WorkerArgs;
 
 
 void init_work_queue(WorkQueue* queue, int capacity);
-void init_thread_pool(ThreadPool* pool, int num_threads, WorkQueue* queue, char *wwwRoot, int timeout, char *cgi_script_path);
+void free_work_queue(WorkQueue* queue);
+void init_thread_pool(ThreadPool* pool, int num_threads, WorkQueue* queue, char *wwwRoot, int timeout, char *cgi_script_path, int keep_alive_timeout, int max_requests, int parser, struct FileCache *cache, struct FdCache *fd_cache, struct FcgiPool *fastcgi, struct Zygote *zygote, struct CgiLoop *cgi_loops, int num_cgi_loops);
 void* worker_thread(void* arg);
+int enqueue_work(WorkQueue* queue, struct Connection *conn);
+int work_queue_full(WorkQueue* queue);
+size_t work_queue_depth(WorkQueue* queue);
+int work_queue_busy(WorkQueue* queue);
+int try_dequeue_work(WorkQueue* queue, WorkItem *item);
+WorkItem dequeue_work(WorkQueue* queue);
+
+#endif
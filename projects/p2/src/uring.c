@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include "uring.h"
+
+// Every SQE's user_data is either one of the fixed values below or a
+// connection pointer tagged in its low bits with what completed.
+#define UD_IGNORE 0                   // link timeouts, leading links of a shed chain
+#define UD_ACCEPT 1
+#define UD_WAKE   2
+#define TAG_RECV  1
+#define TAG_CLOSE 2
+#define TAG_MASK  7
+
+static void ring_teardown(Ring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+}
+
+static int ring_setup(Ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    // Completions for every open connection can pile up between two reaps.
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 8;
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring_teardown(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring_teardown(ring);
+            return -1;
+        }
+    }
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring_teardown(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqe_tail = *ring->sq_tail;
+
+    // SQEs are used in ring order, so the indirection array never changes.
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i) {
+        array[i] = i;
+    }
+
+    char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * Hands every SQE filled so far to the kernel and, if wait is set, blocks
+ * until at least one completion is there.
+ */
+static int ring_submit(Ring *ring, int wait) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        unsigned pending = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        int ret = syscall(__NR_io_uring_enter, ring->fd, pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0 || errno != EINTR) {
+            return ret;
+        }
+    }
+}
+
+// Makes sure the next n SQEs go out in one submission: a link chain that
+// straddles two io_uring_enter() calls would be cut in half.
+static void ring_reserve(Ring *ring, unsigned n) {
+    while (ring->sq_entries - (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) < n) {
+        if (ring_submit(ring, 0) < 0) {
+            perror("io_uring_enter");
+        }
+    }
+}
+
+static struct io_uring_sqe* ring_get_sqe(Ring *ring) {
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void buf_return(UringLoop *uring, unsigned short bid) {
+    struct io_uring_buf *buf = &uring->bufs->bufs[uring->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uintptr_t)(uring->buf_space + (size_t)bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    uring->buf_tail++;
+    __atomic_store_n(&uring->bufs->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Idle connections hold no memory of their own for reading: the kernel
+// picks one of these buffers only once data has actually arrived.
+static int setup_buffers(UringLoop *uring) {
+    size_t ring_size = (URING_BUFFERS * sizeof(struct io_uring_buf) + 4095) & ~(size_t)4095;
+    struct io_uring_buf_reg reg;
+
+    uring->bufs = aligned_alloc(4096, ring_size);
+    uring->buf_space = malloc((size_t)URING_BUFFERS * BUFFER_SIZE);
+    if (!uring->bufs || !uring->buf_space) {
+        free(uring->bufs);
+        free(uring->buf_space);
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(uring->bufs, 0, ring_size);
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)uring->bufs;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, uring->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(uring->bufs);
+        free(uring->buf_space);
+        return -1;
+    }
+
+    uring->buf_tail = 0;
+    for (unsigned short bid = 0; bid < URING_BUFFERS; ++bid) {
+        buf_return(uring, bid);
+    }
+    return 0;
+}
+
+static void arm_accept(UringLoop *uring) {
+    ring_reserve(&uring->ring, 1);
+    struct io_uring_sqe *sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = uring->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD_ACCEPT;
+}
+
+static void arm_wake(UringLoop *uring) {
+    ring_reserve(&uring->ring, 1);
+    struct io_uring_sqe *sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = uring->wake_fd;
+    sqe->addr = (uintptr_t)&uring->wake_value;
+    sqe->len = sizeof(uring->wake_value);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = UD_WAKE;
+}
+
+/**
+ * Waits for the next bytes from the client, or for its deadline: the recv
+ * is linked to an absolute timeout on the same clock as conn->deadline, so
+ * expiry needs no idle list. Only call this from the ring's own thread.
+ */
+void uring_loop_watch(UringLoop *uring, Connection *conn) {
+    ring_reserve(&uring->ring, 2);
+
+    conn->expires.tv_sec = conn->deadline / 1000;
+    conn->expires.tv_nsec = (conn->deadline % 1000) * 1000000;
+
+    struct io_uring_sqe *sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->len = BUFFER_SIZE - 1 - conn->buf_len;
+    sqe->flags = IOSQE_BUFFER_SELECT | IOSQE_IO_LINK;
+    sqe->buf_group = 0;
+    sqe->user_data = (uintptr_t)conn | TAG_RECV;
+
+    sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)&conn->expires;
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;
+    sqe->user_data = UD_IGNORE;
+}
+
+// The overload answer as one chain, like shed_connection(): drain what the
+// client sent, send, half-close, close. Closing with unread data would
+// reset the connection and lose the 503. The connection's own buffer is
+// free to take the discarded bytes. Hard links keep the chain going even
+// if the client is already gone or there is nothing to read.
+static void shed(UringLoop *uring, Connection *conn) {
+    ring_reserve(&uring->ring, 4);
+
+    struct io_uring_sqe *sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t)conn->buf;
+    sqe->len = sizeof(conn->buf);
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = UD_IGNORE;
+
+    sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t)overload_response;
+    sqe->len = overload_response_length;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = UD_IGNORE;
+
+    sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = conn->fd;
+    sqe->len = SHUT_WR;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = UD_IGNORE;
+
+    sqe = ring_get_sqe(&uring->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->fd;
+    sqe->user_data = (uintptr_t)conn | TAG_CLOSE;
+
+    atomic_fetch_add_explicit(&shed_count, 1, memory_order_relaxed);
+}
+
+static void on_accept(UringLoop *uring, struct io_uring_cqe *cqe) {
+    if (cqe->res >= 0) {
+        Connection *conn = new_connection(cqe->res, NULL, uring->port);
+        if (!conn) {
+            close(cqe->res);
+        } else if (work_queue_full(uring->loop->work_queue)) {
+            shed(uring, conn);
+        } else {
+            event_loop_add(uring->loop, conn);
+        }
+    } else {
+        fprintf(stderr, "ERROR on accept: %s\n", strerror(-cqe->res));
+    }
+
+    // Multishot accept stays armed until the kernel says otherwise.
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        arm_accept(uring);
+    }
+}
+
+static void on_recv(UringLoop *uring, Connection *conn, struct io_uring_cqe *cqe) {
+    if (cqe->res > 0) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        // The keep-alive idle timer stops once a new request starts arriving.
+        if (conn->buf_len == 0 && conn->requests_served > 0) {
+            conn->deadline = now_ms() + uring->loop->timeout;
+        }
+        memcpy(conn->buf + conn->buf_len, uring->buf_space + (size_t)bid * BUFFER_SIZE, cqe->res);
+        conn->buf_len += cqe->res;
+        conn->prefetched = 1;
+        buf_return(uring, bid);
+
+        if (enqueue_work(uring->loop->work_queue, conn) < 0) {
+            shed(uring, conn);
+        }
+        return;
+    }
+
+    switch (-cqe->res) {
+        case ENOBUFS:
+        case EAGAIN:
+        case EINTR:
+            uring_loop_watch(uring, conn);
+            break;
+        case ECANCELED:
+            // Cut short by the linked timeout.
+            expire_connection(conn);
+            break;
+        default:
+            close_connection(conn);
+            break;
+    }
+}
+
+static void on_wake(UringLoop *uring) {
+    pthread_mutex_lock(&uring->mutex);
+    Connection *conn = uring->returned;
+    uring->returned = NULL;
+    pthread_mutex_unlock(&uring->mutex);
+
+    while (conn) {
+        Connection *next = conn->next;
+        conn->next = NULL;
+        uring_loop_watch(uring, conn);
+        conn = next;
+    }
+    arm_wake(uring);
+}
+
+static void* uring_loop_thread(void *arg) {
+    UringLoop *uring = (UringLoop *)arg;
+    Ring *ring = &uring->ring;
+
+    arm_accept(uring);
+    arm_wake(uring);
+
+    while (1) {
+        if (ring_submit(ring, 1) < 0) {
+            perror("io_uring_enter");
+            continue;
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+            if (cqe.user_data == UD_IGNORE) {
+                continue;
+            }
+            if (cqe.user_data == UD_ACCEPT) {
+                on_accept(uring, &cqe);
+                continue;
+            }
+            if (cqe.user_data == UD_WAKE) {
+                on_wake(uring);
+                continue;
+            }
+
+            Connection *conn = (Connection *)(uintptr_t)(cqe.user_data & ~(uint64_t)TAG_MASK);
+            if ((cqe.user_data & TAG_MASK) == TAG_RECV) {
+                on_recv(uring, conn, &cqe);
+            } else {
+                // The shed chain has closed the socket already.
+                free(conn);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Sets up a ring for listen_fd and makes loop its front for the workers.
+ * Returns -1 with errno set if this kernel cannot run the engine (no
+ * io_uring, or too old for multishot accept and provided buffer rings),
+ * in which case the caller falls back to epoll.
+ */
+int init_uring_loop(UringLoop *uring, EventLoop *loop, WorkQueue *queue, int timeout, int listen_fd, int port) {
+    if (ring_setup(&uring->ring, URING_ENTRIES) < 0) {
+        return -1;
+    }
+    if (setup_buffers(uring) < 0) {
+        int saved = errno;
+        ring_teardown(&uring->ring);
+        errno = saved;
+        return -1;
+    }
+    uring->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (uring->wake_fd < 0) {
+        int saved = errno;
+        ring_teardown(&uring->ring);
+        free(uring->bufs);
+        free(uring->buf_space);
+        errno = saved;
+        return -1;
+    }
+
+    uring->loop = loop;
+    uring->listen_fd = listen_fd;
+    uring->port = port;
+    uring->returned = NULL;
+    pthread_mutex_init(&uring->mutex, NULL);
+
+    loop->epfd = -1;
+    loop->uring = uring;
+    loop->work_queue = queue;
+    loop->timeout = timeout;
+    loop->idle_head = NULL;
+    loop->idle_tail = NULL;
+    pthread_mutex_init(&loop->mutex, NULL);
+    return 0;
+}
+
+void start_uring_loop(UringLoop *uring) {
+    pthread_create(&uring->thread, NULL, uring_loop_thread, uring);
+}
+
+/**
+ * Called by a worker that is done with the socket for now. The ring is
+ * only ever touched by its own thread, so the connection is queued and the
+ * thread woken through the eventfd.
+ */
+void uring_loop_rearm(UringLoop *uring, Connection *conn) {
+    pthread_mutex_lock(&uring->mutex);
+    int was_empty = uring->returned == NULL;
+    conn->next = uring->returned;
+    uring->returned = conn;
+    pthread_mutex_unlock(&uring->mutex);
+
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(uring->wake_fd, &one, sizeof(one)) < 0) {
+            perror("write(eventfd)");
+        }
+    }
+}
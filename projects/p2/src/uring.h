@@ -0,0 +1,53 @@
+#ifndef URING_H
+#define URING_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include "event_loop.h"
+
+#define URING_ENTRIES 256
+#define URING_BUFFERS 64              // provided receive buffers per ring, a power of two
+
+// The io_uring instance itself, driven with raw syscalls (no liburing).
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;                // next free SQE, published on submit
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+} Ring;
+
+// Accepts and reads for one listener on a single ring, in place of the
+// accept loop and epoll loops. Workers still serve the requests.
+typedef struct UringLoop {
+    Ring ring;
+    EventLoop *loop;                  // what workers see as conn->loop
+    int listen_fd;
+    int port;
+    struct io_uring_buf_ring *bufs;   // receive buffers the kernel picks from
+    char *buf_space;
+    unsigned short buf_tail;
+    int wake_fd;                      // eventfd workers poke after a hand-back
+    uint64_t wake_value;
+    pthread_mutex_t mutex;
+    Connection *returned;             // handed back by workers, guarded by mutex
+    pthread_t thread;
+} UringLoop;
+
+int init_uring_loop(UringLoop *uring, EventLoop *loop, WorkQueue *queue, int timeout, int listen_fd, int port);
+void start_uring_loop(UringLoop *uring);
+void uring_loop_watch(UringLoop *uring, Connection *conn);
+void uring_loop_rearm(UringLoop *uring, Connection *conn);
+
+#endif
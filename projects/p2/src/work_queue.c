@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "thread_pool.h"
+
+// How many times an idle worker polls the ring before it parks. Only worth
+// it when a producer can run on another CPU in the meantime.
+#define DEQUEUE_SPINS 64
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void init_work_queue(WorkQueue* queue, int capacity) {
+    size_t size = 2;
+    while (size < (size_t)capacity) {
+        size <<= 1;
+    }
+
+    queue->cells = aligned_alloc(64, ((sizeof(WorkCell) * size + 63) / 64) * 64);
+    if (!queue->cells) {
+        perror("Failed to allocate memory for work queue");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < size; ++i) {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+    queue->mask = size - 1;
+    queue->limit = capacity > 0 ? (size_t)capacity : 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    atomic_init(&queue->wakeups, 0);
+    atomic_init(&queue->sleepers, 0);
+    queue->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? DEQUEUE_SPINS : 0;
+    queue->workers = 0;
+}
+
+void free_work_queue(WorkQueue* queue) {
+    free(queue->cells);
+}
+
+// Wakes one parked worker, if any. A worker counts as parked from just
+// before its last look at the ring until it is running again, so this may
+// wake nobody, but it never skips a worker that is about to sleep.
+static void wake_one(WorkQueue* queue) {
+    if (atomic_load(&queue->sleepers) > 0) {
+        syscall(SYS_futex, &queue->wakeups, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static size_t depth(WorkQueue* queue) {
+    return atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed) -
+           atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+}
+
+/**
+ * Whether the queue is at its configured limit. Only a hint, since other
+ * threads move both ends concurrently, but good enough for admission.
+ */
+int work_queue_full(WorkQueue* queue) {
+    return depth(queue) >= queue->limit;
+}
+
+// Connections waiting for a worker; a hint like work_queue_full().
+size_t work_queue_depth(WorkQueue* queue) {
+    return depth(queue);
+}
+
+// Workers not parked on the queue, the caller included if it is one.
+int work_queue_busy(WorkQueue* queue) {
+    int busy = queue->workers - atomic_load_explicit(&queue->sleepers, memory_order_relaxed);
+    return busy > 0 ? busy : 0;
+}
+
+/**
+ * Adds a connection without taking any lock. Returns 0, or -1 if the queue
+ * is at its limit and the caller has to deal with the connection itself.
+ */
+int enqueue_work(WorkQueue* queue, struct Connection *conn) {
+    WorkCell *cell;
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // The ring itself may be larger than the configured limit.
+            if (pos - atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed) >= queue->limit) {
+                return -1;
+            }
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->item.conn = conn;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+    // Pairs with dequeue_work(): either a parking worker sees the new
+    // wakeups value, or we see it in sleepers and wake it.
+    atomic_fetch_add(&queue->wakeups, 1);
+    wake_one(queue);
+    return 0;
+}
+
+/**
+ * Takes the oldest item if there is one. Returns 1 on success, 0 if empty.
+ */
+int try_dequeue_work(WorkQueue* queue, WorkItem *item) {
+    WorkCell *cell;
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *item = cell->item;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * Blocks until an item is available. Spins briefly first, since under load
+ * the next connection is usually only microseconds away.
+ */
+WorkItem dequeue_work(WorkQueue* queue) {
+    WorkItem item;
+
+    for (;;) {
+        for (int spin = 0; spin < queue->spins; ++spin) {
+            if (try_dequeue_work(queue, &item)) {
+                return item;
+            }
+            cpu_relax();
+        }
+
+        atomic_fetch_add(&queue->sleepers, 1);
+        uint32_t seen = atomic_load(&queue->wakeups);
+        int got = try_dequeue_work(queue, &item);
+        if (!got) {
+            syscall(SYS_futex, &queue->wakeups, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+        }
+        atomic_fetch_sub(&queue->sleepers, 1);
+        if (got || try_dequeue_work(queue, &item)) {
+            return item;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include "zygote.h"
+
+/**
+ * Starts the zygote program at path with its end of the request socket as
+ * fd 0. Returns -1 with errno set if it cannot be started.
+ */
+int zygote_start(Zygote *zygote, const char *path) {
+    int fds[2];
+
+    if (access(path, X_OK) < 0 || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        return -1;
+    }
+    zygote->pid = fork();
+    if (zygote->pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (zygote->pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (dup2(fds[1], STDIN_FILENO) < 0) {
+            perror("dup2");
+            _exit(EXIT_FAILURE);
+        }
+        const char *name = strrchr(path, '/');
+        execl(path, name ? name + 1 : path, NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+    zygote->fd = fds[0];
+    pthread_mutex_init(&zygote->lock, NULL);
+    return 0;
+}
+
+static int append_string(char *message, size_t *length, const char *string) {
+    size_t string_length = strlen(string) + 1;
+    if (*length + string_length > ZYGOTE_MESSAGE_MAX) {
+        return -1;
+    }
+    memcpy(message + *length, string, string_length);
+    *length += string_length;
+    return 0;
+}
+
+/**
+ * Has the zygote run script with the environment envp and the given
+ * descriptors as its stdin and stdout. The message is the script path
+ * and then each variable, all NUL-terminated. On success *pidfd is a
+ * pidfd for the child, or -1 if it exited before the zygote could open
+ * one. Returns -1 if the zygote cannot take the request, in which case
+ * the caller starts the script itself.
+ */
+int zygote_spawn(Zygote *zygote, const char *script, char *const envp[], int stdin_fd, int stdout_fd, int *pidfd) {
+    char message[ZYGOTE_MESSAGE_MAX];
+    size_t length = 0;
+
+    if (append_string(message, &length, script) < 0) {
+        return -1;
+    }
+    for (int i = 0; envp[i]; ++i) {
+        if (append_string(message, &length, envp[i]) < 0) {
+            return -1;
+        }
+    }
+
+    int fds[2] = { stdin_fd, stdout_fd };
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov = { message, length };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // The zygote forks one child at a time anyway, so holding the lock
+    // until it answers costs the workers nothing.
+    pthread_mutex_lock(&zygote->lock);
+    ssize_t n;
+    do {
+        n = sendmsg(zygote->fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)length) {
+        pthread_mutex_unlock(&zygote->lock);
+        return -1;
+    }
+
+    // The answer is one byte, 0 if the child was forked, with its pidfd
+    // attached unless it is already gone.
+    char answer;
+    iov.iov_base = &answer;
+    iov.iov_len = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    do {
+        n = recvmsg(zygote->fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    pthread_mutex_unlock(&zygote->lock);
+    if (n < 1) {
+        return -1;
+    }
+
+    *pidfd = -1;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+            memcpy(pidfd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if (answer != 0) {
+        if (*pidfd >= 0) {
+            close(*pidfd);
+        }
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define ZYGOTE_MESSAGE_MAX 32768      // script path and environment of one request
+
+// A helper process that has loaded the Python interpreter and common
+// modules once, and forks a child from that state for every Python CGI
+// request. Requests go over a SOCK_SEQPACKET pair, one message each,
+// with the script's stdin and stdout passed along as SCM_RIGHTS. The
+// zygote answers each with a pidfd for the child, so the server can kill
+// it even though it is not the server's child.
+typedef struct Zygote {
+    int fd;
+    pid_t pid;
+    pthread_mutex_t lock;         // pairs each request with its answer
+} Zygote;
+
+int zygote_start(Zygote *zygote, const char *path);
+int zygote_spawn(Zygote *zygote, const char *script, char *const envp[], int stdin_fd, int stdout_fd, int *pidfd);
+
+#endif
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+# The zygote behind --zygote. The interpreter and the modules CGI scripts
+# commonly use are loaded once here; each request from the server (see
+# zygote.c) then forks a child from this warm state, which runs the script
+# with the same stdin, stdout and environment a freshly started one gets.
+# Each request is answered with one byte, 0 once the child is forked, with
+# a pidfd for it attached so the server can kill it on its timeout.
+
+import importlib, os, runpy, signal, socket, sys, traceback, warnings
+
+PRELOAD = ['cgi', 'cgitb', 'html', 'json', 'urllib.parse', 're', 'datetime', 'time', 'random']
+MESSAGE_MAX = 32768  # ZYGOTE_MESSAGE_MAX
+
+with warnings.catch_warnings():
+    warnings.simplefilter('ignore', DeprecationWarning)
+    for name in PRELOAD:
+        try:
+            importlib.import_module(name)
+        except ImportError:
+            pass
+
+
+def run(server, message, fds):
+    signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+    server.close()
+    os.dup2(fds[0], 0)
+    os.dup2(fds[1], 1)
+    for fd in fds:
+        os.close(fd)
+
+    strings = message.split(b'\0')[:-1]
+    script = os.fsdecode(strings[0])
+    os.environ.clear()
+    for string in strings[1:]:
+        name, _, value = os.fsdecode(string).partition('=')
+        os.environ[name] = value
+    sys.argv = [script]
+    sys.path[0] = os.path.dirname(script)
+    if 'random' in sys.modules:
+        # Otherwise every child would draw the same numbers.
+        sys.modules['random'].seed()
+
+    status = 0
+    try:
+        runpy.run_path(script, run_name='__main__')
+    except SystemExit as e:
+        status = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)
+    except BaseException:
+        traceback.print_exc()
+        status = 1
+    try:
+        sys.stdout.flush()
+    except OSError:
+        pass
+    os._exit(status)
+
+
+def main():
+    server = socket.socket(fileno=0)
+    # Children are reaped by the kernel; the server only waits for EOF.
+    signal.signal(signal.SIGCHLD, signal.SIG_IGN)
+    while True:
+        try:
+            message, fds, _, _ = socket.recv_fds(server, MESSAGE_MAX, 2)
+        except InterruptedError:
+            continue
+        if not message:
+            return
+        answer, pidfds = b'\1', []
+        if len(fds) == 2:
+            try:
+                pid = os.fork()
+                if pid == 0:
+                    run(server, message, fds)
+                answer = b'\0'
+                # Fails if the child has already exited and been reaped.
+                pidfds.append(os.pidfd_open(pid))
+            except (OSError, AttributeError):
+                if answer != b'\0':
+                    traceback.print_exc()
+        for fd in fds:
+            os.close(fd)
+        try:
+            socket.send_fds(server, [answer], pidfds)
+        except OSError:
+            return
+        for fd in pidfds:
+            os.close(fd)
+
+
+sys.stdout.flush()
+main()